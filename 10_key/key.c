@@ -13,6 +13,11 @@
 #include <linux/gpio.h>
 #include <linux/of_gpio.h>
 
+#include "../common/fop_stats.h"
+
+#define CREATE_TRACE_POINTS
+#include "key_trace.h"
+
 #define KEY_CNT 1
 #define KEY_NAME "key"
 
@@ -46,8 +51,10 @@ static ssize_t key_read(struct file *filp, char __user *buf,
     struct key_dev *dev = filp->private_data;
     int ret = 0;
     int value = 0;
+    int level = gpio_get_value(dev->key_gpio);
 
-    if (gpio_get_value(dev->key_gpio) == 0) {   // 按下
+    trace_key_read_enter(level);
+    if (level == 0) {   // 按下
         while (!gpio_get_value(dev->key_gpio)); // 等待松开
         atomic_set(&dev->key_value, KEY0_VALUE);
     } else {
@@ -55,9 +62,10 @@ static ssize_t key_read(struct file *filp, char __user *buf,
     }
 
     value = atomic_read(&dev->key_value);
-    ret = copy_to_user(buf, &value, sizeof(value));
+    ret = copy_to_user(buf, &value, sizeof(value)) ? -EFAULT : 0;
+    trace_key_read_exit(value, ret);
 
-    return 0;
+    return ret;
 }
 
 static ssize_t key_write(struct file *filp, const char __user *buf,  
@@ -144,7 +152,7 @@ static int __init key_init(void)
 
     /* 添加字符设备 */
     key.cdev.owner = THIS_MODULE;
-    cdev_init(&key.cdev, &key_fops);
+    cdev_init(&key.cdev, fop_stats_init(KEY_NAME, &key_fops));
     ret = cdev_add(&key.cdev, key.devid, KEY_CNT);
     if (ret < 0) {
         printk("cdev_add failed.\n");
@@ -185,6 +193,7 @@ fail_class:
     /* 删除字符设备 */
     cdev_del(&key.cdev);
 fail_cdev:
+    fop_stats_exit();
     /* 释放设备号 */
     unregister_chrdev_region(key.devid, KEY_CNT);
 fail_devid:
@@ -201,6 +210,7 @@ static void __exit key_exit(void)
     class_destroy(key.class);
     /* 删除字符设备 */
     cdev_del(&key.cdev);
+    fop_stats_exit();
     /* 释放设备号 */
     unregister_chrdev_region(key.devid, KEY_CNT);
 }
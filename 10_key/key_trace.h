@@ -0,0 +1,46 @@
+/*
+ * key 跟踪点，关闭时只是一条不跳转的指令。
+ * 驱动没有中断，按键在 read 中轮询，enter 到 exit 的时间包含等待松开。
+ * /sys/kernel/debug/tracing/events/drv_key/ 或 trace/ 下的脚本
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM drv_key
+
+#if !defined(_KEY_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _KEY_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(key_read_enter,
+    TP_PROTO(int level),
+    TP_ARGS(level),
+    TP_STRUCT__entry(
+        __field(int, level)
+    ),
+    TP_fast_assign(
+        __entry->level = level;
+    ),
+    TP_printk("level=%d", __entry->level)
+);
+
+TRACE_EVENT(key_read_exit,
+    TP_PROTO(int value, ssize_t ret),
+    TP_ARGS(value, ret),
+    TP_STRUCT__entry(
+        __field(int, value)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->value = value;
+        __entry->ret = ret;
+    ),
+    TP_printk("value=%#x ret=%zd", __entry->value, __entry->ret)
+);
+
+#endif /* _KEY_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE key_trace
+#include <trace/define_trace.h>
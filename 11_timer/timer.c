@@ -15,6 +15,11 @@
 #include <linux/timer.h>
 #include <linux/jiffies.h>
 
+#include "../common/fop_stats.h"
+
+#define CREATE_TRACE_POINTS
+#include "timer_trace.h"
+
 #define DRIVER_CNT 1
 #define DRIVER_NAME "timer"
 
@@ -62,6 +67,7 @@ static long driver_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     int ret = 0;
     int value = 0;
     
+    trace_timer_ioctl_enter(cmd, arg);
     switch (cmd)
     {
     case CLOSE_CMD:
@@ -71,9 +77,9 @@ static long driver_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
         mod_timer(&dev->timer, jiffies + msecs_to_jiffies(dev->timeperiod));
         break;
     case SETPERIOD_CMD:
-        ret = copy_from_user(&value, (int *)arg, sizeof(int));
-        if (ret < 0) {
-            return -EFAULT;
+        if (copy_from_user(&value, (int *)arg, sizeof(int))) {
+            ret = -EFAULT;
+            break;
         }
         dev->timeperiod = value;
         mod_timer(&dev->timer, jiffies + msecs_to_jiffies(dev->timeperiod));
@@ -81,6 +87,7 @@ static long driver_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     default:
         break;
     }
+    trace_timer_ioctl_exit(cmd, ret);
 
     return ret;
 }
@@ -153,6 +160,7 @@ static void timer_func(unsigned long arg)
 
     sta = !sta;
     gpio_set_value(dev->led_gpio, sta);
+    trace_timer_expire(sta, dev->timeperiod, (long)(jiffies - dev->timer.expires));
 
     mod_timer(&dev->timer, jiffies + msecs_to_jiffies(dev->timeperiod));
 }
@@ -173,7 +181,7 @@ static int __init my_driver_init(void)
 
     /* 添加字符设备 */
     dev.cdev.owner = THIS_MODULE;
-    cdev_init(&dev.cdev, &key_fops);
+    cdev_init(&dev.cdev, fop_stats_init(DRIVER_NAME, &key_fops));
     ret = cdev_add(&dev.cdev, dev.devid, DRIVER_CNT);
     if (ret < 0) {
         printk("cdev_add failed.\n");
@@ -223,6 +231,7 @@ fail_class:
     /* 删除字符设备 */
     cdev_del(&dev.cdev);
 fail_cdev:
+    fop_stats_exit();
     /* 释放设备号 */
     unregister_chrdev_region(dev.devid, DRIVER_CNT);
 fail_devid:
@@ -243,6 +252,7 @@ static void __exit my_driver_exit(void)
     class_destroy(dev.class);
     /* 删除字符设备 */
     cdev_del(&dev.cdev);
+    fop_stats_exit();
     /* 释放设备号 */
     unregister_chrdev_region(dev.devid, DRIVER_CNT);
 }
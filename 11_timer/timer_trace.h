@@ -0,0 +1,64 @@
+/*
+ * timer 跟踪点，关闭时只是一条不跳转的指令。
+ * /sys/kernel/debug/tracing/events/drv_timer/ 或 trace/ 下的脚本
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM drv_timer
+
+#if !defined(_TIMER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TIMER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* late 为实际到期时刻晚于预定 expires 的 jiffies 数 */
+TRACE_EVENT(timer_expire,
+    TP_PROTO(int level, int period_ms, long late),
+    TP_ARGS(level, period_ms, late),
+    TP_STRUCT__entry(
+        __field(int, level)
+        __field(int, period_ms)
+        __field(long, late)
+    ),
+    TP_fast_assign(
+        __entry->level = level;
+        __entry->period_ms = period_ms;
+        __entry->late = late;
+    ),
+    TP_printk("level=%d period=%dms late=%ld", __entry->level, __entry->period_ms, __entry->late)
+);
+
+TRACE_EVENT(timer_ioctl_enter,
+    TP_PROTO(unsigned int cmd, unsigned long arg),
+    TP_ARGS(cmd, arg),
+    TP_STRUCT__entry(
+        __field(unsigned int, cmd)
+        __field(unsigned long, arg)
+    ),
+    TP_fast_assign(
+        __entry->cmd = cmd;
+        __entry->arg = arg;
+    ),
+    TP_printk("cmd=%#x arg=%#lx", __entry->cmd, __entry->arg)
+);
+
+TRACE_EVENT(timer_ioctl_exit,
+    TP_PROTO(unsigned int cmd, long ret),
+    TP_ARGS(cmd, ret),
+    TP_STRUCT__entry(
+        __field(unsigned int, cmd)
+        __field(long, ret)
+    ),
+    TP_fast_assign(
+        __entry->cmd = cmd;
+        __entry->ret = ret;
+    ),
+    TP_printk("cmd=%#x ret=%ld", __entry->cmd, __entry->ret)
+);
+
+#endif /* _TIMER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE timer_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,444 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/percpu.h>
+#include <linux/delay.h>
+#include <linux/ktime.h>
+
+/*
+ * 同步原语竞争测试。open/release/write 在所选原语下修改共享数据，read 走读侧，
+ * 每次操作记录从开始获取到拿到锁的时间，按 CPU 累加到直方图，由 ioctl 读出。
+ * 应用见 12_lockbench_app。
+ */
+
+#define LOCKBENCH_CNT 1
+#define LOCKBENCH_NAME "lockbench"
+
+/* 同步原语 */
+#define LB_ATOMIC   0   /* atomic_t 构成的 test-and-set 自旋锁，即 8_atomic 的做法 */
+#define LB_SPINLOCK 1
+#define LB_MUTEX    2
+#define LB_SEQLOCK  3   /* 读者不加锁，遇到并发写重试 */
+#define LB_RCU      4   /* 读者无锁，写者复制后替换 */
+#define LB_MODES    5
+
+#define LB_BUCKETS  128 /* 每 2 倍区间 4 格，覆盖到约 4s */
+
+#define LOCKBENCH_MODE_CMD  _IOW(0xEF, 1, __u32)                    // 选择原语，同时清零统计
+#define LOCKBENCH_HOLD_CMD  _IOW(0xEF, 2, __u32)                    // 临界区内停留 ns
+#define LOCKBENCH_STATS_CMD _IOR(0xEF, 3, struct lockbench_stats)   // 读取各 CPU 汇总的统计
+#define LOCKBENCH_RESET_CMD _IO(0xEF, 4)                            // 清零统计
+
+struct lockbench_stats {
+    __u64 ops;
+    __u64 retries;              /* seqlock 读者重试次数 */
+    __u64 max_ns;
+    __u64 hist[LB_BUCKETS];     /* 获取时间直方图，下标含义见 lb_bucket */
+};
+
+/* LB_RCU 下由读者看到的快照 */
+struct lb_snap {
+    u64 value;
+    struct rcu_head rcu;
+};
+
+/* lockbench设备结构体 */
+struct lockbench_dev {
+    dev_t devid;
+    int major;
+    int minor;
+    struct cdev cdev;       /* 字符设备 */
+    struct class *class;    /* 类 */
+    struct device *device;  /* 设备 */
+
+    u32 mode;               /* 只应在无其他打开者时切换 */
+    u32 hold_ns;
+
+    atomic_t alock;
+    spinlock_t slock;
+    struct mutex mlock;
+    seqlock_t seq;
+    spinlock_t rcu_lock;    /* LB_RCU 写者之间互斥 */
+    struct lb_snap __rcu *snap;
+
+    /* 由当前原语保护的共享数据 */
+    long users;
+    u64 value;
+};
+
+struct lockbench_dev lockbench;
+
+/* 统计按 CPU 分开累加，避免统计本身成为竞争点 */
+static DEFINE_PER_CPU(struct lockbench_stats, lb_stats);
+
+/* 小于 4ns 直接作下标，之后每个 2 的幂区间分 4 格 */
+static unsigned int lb_bucket(u64 ns)
+{
+    unsigned int b = 0;
+    unsigned int idx = 0;
+
+    if (ns < 4) {
+        return ns;
+    }
+    b = fls64(ns) - 1;
+    idx = (b - 1) * 4 + ((ns >> (b - 2)) & 3);
+    return min_t(unsigned int, idx, LB_BUCKETS - 1);
+}
+
+static void lb_record(u64 ns, u64 retries)
+{
+    struct lockbench_stats *st = get_cpu_ptr(&lb_stats);
+
+    st->ops++;
+    st->retries += retries;
+    st->hist[lb_bucket(ns)]++;
+    if (ns > st->max_ns) {
+        st->max_ns = ns;
+    }
+    put_cpu_ptr(&lb_stats);
+}
+
+/* 写侧加锁，返回获取用时 */
+static u64 lb_lock(struct lockbench_dev *dev, u32 mode)
+{
+    u64 t0 = ktime_get_ns();
+
+    switch (mode) {
+    case LB_ATOMIC:
+        /* 关抢占，持有者不会在临界区内被换出而让其他 CPU 空转 */
+        preempt_disable();
+        while (atomic_read(&dev->alock) || atomic_cmpxchg(&dev->alock, 0, 1) != 0) {
+            cpu_relax();
+        }
+        break;
+    case LB_SPINLOCK:
+        spin_lock(&dev->slock);
+        break;
+    case LB_MUTEX:
+        mutex_lock(&dev->mlock);
+        break;
+    case LB_SEQLOCK:
+        write_seqlock(&dev->seq);
+        break;
+    case LB_RCU:
+        spin_lock(&dev->rcu_lock);
+        break;
+    }
+
+    return ktime_get_ns() - t0;
+}
+
+static void lb_unlock(struct lockbench_dev *dev, u32 mode)
+{
+    switch (mode) {
+    case LB_ATOMIC:
+        smp_mb();   /* 临界区内的写先于解锁可见 */
+        atomic_set(&dev->alock, 0);
+        preempt_enable();
+        break;
+    case LB_SPINLOCK:
+        spin_unlock(&dev->slock);
+        break;
+    case LB_MUTEX:
+        mutex_unlock(&dev->mlock);
+        break;
+    case LB_SEQLOCK:
+        write_sequnlock(&dev->seq);
+        break;
+    case LB_RCU:
+        spin_unlock(&dev->rcu_lock);
+        break;
+    }
+}
+
+/* 模拟临界区内的工作 */
+static inline void lb_hold(struct lockbench_dev *dev)
+{
+    if (dev->hold_ns) {
+        ndelay(dev->hold_ns);
+    }
+}
+
+/* open/release 只改打开计数，与 8_atomic、9_spinlock 的临界区相当 */
+static void lb_users_add(struct lockbench_dev *dev, long n)
+{
+    u32 mode = READ_ONCE(dev->mode);
+    u64 ns = lb_lock(dev, mode);
+
+    dev->users += n;
+    lb_hold(dev);
+    lb_unlock(dev, mode);
+    lb_record(ns, 0);
+}
+
+static int lockbench_open(struct inode *inode, struct file *filp)
+{
+    filp->private_data = &lockbench;
+    lb_users_add(&lockbench, 1);
+    return 0;
+}
+
+static int lockbench_release(struct inode *inode, struct file *filp)
+{
+    lb_users_add(filp->private_data, -1);
+    return 0;
+}
+
+static ssize_t lockbench_read(struct file *filp, char __user *buf,
+                               size_t cnt, loff_t *offt)
+{
+    struct lockbench_dev *dev = filp->private_data;
+    u32 mode = READ_ONCE(dev->mode);
+    unsigned int start = 0;
+    u64 retries = 0;
+    u64 value = 0;
+    u64 ns = 0;
+    u64 t0 = 0;
+
+    if (cnt < sizeof(value)) {
+        return -EINVAL;
+    }
+
+    switch (mode) {
+    case LB_SEQLOCK:
+        /* 获取用时为拿到一致数据的时间，含重试 */
+        t0 = ktime_get_ns();
+        do {
+            start = read_seqbegin(&dev->seq);
+            value = dev->value;
+            retries++;
+        } while (read_seqretry(&dev->seq, start));
+        ns = ktime_get_ns() - t0;
+        retries--;
+        break;
+    case LB_RCU:
+        t0 = ktime_get_ns();
+        rcu_read_lock();
+        ns = ktime_get_ns() - t0;
+        value = rcu_dereference(dev->snap)->value;
+        rcu_read_unlock();
+        break;
+    default:
+        ns = lb_lock(dev, mode);
+        value = dev->value;
+        lb_unlock(dev, mode);
+        break;
+    }
+    lb_record(ns, retries);
+
+    if (copy_to_user(buf, &value, sizeof(value))) {
+        return -EFAULT;
+    }
+    return sizeof(value);
+}
+
+static ssize_t lockbench_write(struct file *filp, const char __user *buf,
+                                size_t cnt, loff_t *offt)
+{
+    struct lockbench_dev *dev = filp->private_data;
+    u32 mode = READ_ONCE(dev->mode);
+    struct lb_snap *new = NULL;
+    struct lb_snap *old = NULL;
+    u64 ns = 0;
+
+    /* RCU 写者先在锁外分配新快照，这部分开销也算在操作里 */
+    if (mode == LB_RCU) {
+        new = kmalloc(sizeof(*new), GFP_KERNEL);
+        if (new == NULL) {
+            return -ENOMEM;
+        }
+    }
+
+    ns = lb_lock(dev, mode);
+    dev->value++;
+    if (mode == LB_RCU) {
+        old = rcu_dereference_protected(dev->snap, lockdep_is_held(&dev->rcu_lock));
+        new->value = dev->value;
+        rcu_assign_pointer(dev->snap, new);
+    }
+    lb_hold(dev);
+    lb_unlock(dev, mode);
+    lb_record(ns, 0);
+
+    if (old) {
+        kfree_rcu(old, rcu);
+    }
+    return cnt;
+}
+
+static void lb_reset(void)
+{
+    int cpu = 0;
+
+    for_each_possible_cpu(cpu) {
+        memset(per_cpu_ptr(&lb_stats, cpu), 0, sizeof(struct lockbench_stats));
+    }
+}
+
+static long lockbench_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct lockbench_dev *dev = filp->private_data;
+    struct lockbench_stats *st = NULL;
+    struct lockbench_stats *pcp = NULL;
+    long ret = 0;
+    u32 val = 0;
+    int cpu = 0;
+    int i = 0;
+
+    switch (cmd)
+    {
+    case LOCKBENCH_MODE_CMD:
+        if (copy_from_user(&val, (void __user *)arg, sizeof(val))) {
+            return -EFAULT;
+        }
+        if (val >= LB_MODES) {
+            return -EINVAL;
+        }
+        /* 进行中的操作按开始时读到的原语加解锁，切换不会让锁失配 */
+        WRITE_ONCE(dev->mode, val);
+        lb_reset();
+        return 0;
+    case LOCKBENCH_HOLD_CMD:
+        if (copy_from_user(&val, (void __user *)arg, sizeof(val))) {
+            return -EFAULT;
+        }
+        if (val > 1000000) {
+            return -EINVAL;     /* 最长 1ms，忙等 */
+        }
+        WRITE_ONCE(dev->hold_ns, val);
+        return 0;
+    case LOCKBENCH_STATS_CMD:
+        st = kzalloc(sizeof(*st), GFP_KERNEL);
+        if (st == NULL) {
+            return -ENOMEM;
+        }
+        for_each_possible_cpu(cpu) {
+            pcp = per_cpu_ptr(&lb_stats, cpu);
+            st->ops += pcp->ops;
+            st->retries += pcp->retries;
+            st->max_ns = max(st->max_ns, pcp->max_ns);
+            for (i = 0; i < LB_BUCKETS; i++) {
+                st->hist[i] += pcp->hist[i];
+            }
+        }
+        if (copy_to_user((void __user *)arg, st, sizeof(*st))) {
+            ret = -EFAULT;
+        }
+        kfree(st);
+        return ret;
+    case LOCKBENCH_RESET_CMD:
+        lb_reset();
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+/* 字符设备操作集合 */
+static struct file_operations lockbench_fops = {
+    .owner = THIS_MODULE,
+    .open = lockbench_open,
+    .read = lockbench_read,
+    .write = lockbench_write,
+    .unlocked_ioctl = lockbench_ioctl,
+    .release = lockbench_release,
+};
+
+static int __init lockbench_init(void)
+{
+    int ret = 0;
+    struct lb_snap *snap = NULL;
+
+    /* 初始化各原语 */
+    atomic_set(&lockbench.alock, 0);
+    spin_lock_init(&lockbench.slock);
+    mutex_init(&lockbench.mlock);
+    seqlock_init(&lockbench.seq);
+    spin_lock_init(&lockbench.rcu_lock);
+    lockbench.mode = LB_SPINLOCK;
+    snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+    if (snap == NULL) {
+        return -ENOMEM;
+    }
+    RCU_INIT_POINTER(lockbench.snap, snap);
+
+    /* 注册设备号 */
+    ret = alloc_chrdev_region(&lockbench.devid, 0, LOCKBENCH_CNT, LOCKBENCH_NAME);
+    if (ret < 0) {
+        printk("alloc_chrdev_region failed.\n");
+        goto fail_devid;
+    }
+    lockbench.major = MAJOR(lockbench.devid);
+    lockbench.minor = MINOR(lockbench.devid);
+    printk("lockbench major = %d, minor = %d\n", lockbench.major, lockbench.minor);
+
+    /* 添加字符设备 */
+    lockbench.cdev.owner = THIS_MODULE;
+    cdev_init(&lockbench.cdev, &lockbench_fops);
+    ret = cdev_add(&lockbench.cdev, lockbench.devid, LOCKBENCH_CNT);
+    if (ret < 0) {
+        printk("cdev_add failed.\n");
+        goto fail_cdev;
+    }
+
+    /* 创建类 */
+    lockbench.class = class_create(THIS_MODULE, LOCKBENCH_NAME);
+    if (IS_ERR(lockbench.class)) {
+        ret = PTR_ERR(lockbench.class);
+        printk("class_create failed.\n");
+        goto fail_class;
+    }
+
+    /* 创建设备 */
+    lockbench.device = device_create(lockbench.class, NULL, lockbench.devid, NULL, LOCKBENCH_NAME);
+    if (IS_ERR(lockbench.device)) {
+        ret = PTR_ERR(lockbench.device);
+        printk("device_create failed.\n");
+        goto fail_device;
+    }
+
+    return 0;
+
+fail_device:
+    /* 销毁类 */
+    class_destroy(lockbench.class);
+fail_class:
+    /* 删除字符设备 */
+    cdev_del(&lockbench.cdev);
+fail_cdev:
+    /* 释放设备号 */
+    unregister_chrdev_region(lockbench.devid, LOCKBENCH_CNT);
+fail_devid:
+    kfree(snap);
+    return ret;
+}
+
+static void __exit lockbench_exit(void)
+{
+    /* 销毁设备 */
+    device_destroy(lockbench.class, lockbench.devid);
+    /* 销毁类 */
+    class_destroy(lockbench.class);
+    /* 删除字符设备 */
+    cdev_del(&lockbench.cdev);
+    /* 释放设备号 */
+    unregister_chrdev_region(lockbench.devid, LOCKBENCH_CNT);
+    /* 已无打开者，之前 kfree_rcu 的旧快照由 RCU 自行释放 */
+    kfree(rcu_dereference_protected(lockbench.snap, 1));
+}
+
+/* 模块入口与出口 */
+module_init(lockbench_init);
+module_exit(lockbench_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("wangpeng");
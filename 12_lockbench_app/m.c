@@ -0,0 +1,365 @@
+/*
+lockbench 同步原语竞争测试，结果以 CSV 输出到 stdout
+
+./lockbench_app [-d dev] [-p prims] [-w loads] [-t threads] [-H ns] [-r pct] [-T ms]
+    -d  设备路径，默认 /dev/lockbench
+    -p  同步原语，逗号分隔: atomic,spinlock,mutex,seqlock,rcu，默认全部
+    -w  负载，逗号分隔: open,write,read,mix，默认全部
+        open 为 open+close，mix 按 -r 的比例读，其余写
+    -t  线程数，逗号分隔，默认 1,2,4，第 i 个线程绑定到 CPU i % ncpu
+    -H  临界区内停留 ns，默认 0
+    -r  mix 负载中读的百分比，默认 90
+    -T  每组测试时长(ms)，默认 1000
+
+ops_per_s 为用户态完成的操作数，open 负载一次 open+close 算一次。
+fairness 为各线程操作数的 Jain 指数，1 表示完全均匀；min_max 为最少与最多线程之比。
+acq_* 为驱动统计的获取时间(从开始加锁到拿到锁，seqlock 读为拿到一致数据的时间)，
+按直方图格子上界给出。
+编译: gcc -O2 -pthread m.c -o lockbench_app
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+#define DEVICE_PATH "/dev/lockbench"
+
+#define LB_BUCKETS  128
+
+#define LOCKBENCH_MODE_CMD  _IOW(0xEF, 1, __u32)                    // 选择原语，同时清零统计
+#define LOCKBENCH_HOLD_CMD  _IOW(0xEF, 2, __u32)                    // 临界区内停留 ns
+#define LOCKBENCH_STATS_CMD _IOR(0xEF, 3, struct lockbench_stats)   // 读取各 CPU 汇总的统计
+#define LOCKBENCH_RESET_CMD _IO(0xEF, 4)                            // 清零统计
+
+struct lockbench_stats {
+    __u64 ops;
+    __u64 retries;
+    __u64 max_ns;
+    __u64 hist[LB_BUCKETS];
+};
+
+#define MAX_THREADS     64
+#define PRIM_COUNT      5
+
+enum bench_load {
+    LOAD_OPEN = 0,
+    LOAD_WRITE,
+    LOAD_READ,
+    LOAD_MIX,
+    LOAD_COUNT,
+};
+
+static const char *prim_names[PRIM_COUNT] = { "atomic", "spinlock", "mutex", "seqlock", "rcu" };
+static const char *load_names[LOAD_COUNT] = { "open", "write", "read", "mix" };
+
+struct bench_thread {
+    pthread_t tid;
+    int cpu;
+    int load;
+    int err;                    /* 0 成功，否则为 errno */
+    unsigned long long ops;
+};
+
+static const char *dev_path = DEVICE_PATH;
+static unsigned int duration_ms = 1000;
+static unsigned int read_pct = 90;
+static volatile int running;
+static pthread_barrier_t barrier;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *bench_worker(void *arg)
+{
+    struct bench_thread *t = arg;
+    unsigned int seed = t->cpu + 1;
+    unsigned long long value = 0;
+    cpu_set_t set;
+    int fd = -1;
+    int rd = 0;
+    ssize_t ret = 0;
+
+    CPU_ZERO(&set);
+    CPU_SET(t->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    if (t->load != LOAD_OPEN) {
+        fd = open(dev_path, O_RDWR);
+        if (fd < 0) {
+            t->err = errno;
+        }
+    }
+
+    pthread_barrier_wait(&barrier);     /* 准备完毕，主线程清零统计 */
+    pthread_barrier_wait(&barrier);     /* 开始 */
+
+    while (running && !t->err) {
+        switch (t->load) {
+        case LOAD_OPEN:
+            ret = open(dev_path, O_RDWR);
+            if (ret >= 0) {
+                close(ret);
+                ret = 0;
+            }
+            break;
+        case LOAD_WRITE:
+            ret = write(fd, &value, 1);
+            break;
+        case LOAD_READ:
+            ret = read(fd, &value, sizeof(value));
+            break;
+        case LOAD_MIX:
+            rd = (unsigned int)rand_r(&seed) % 100 < read_pct;
+            ret = rd ? read(fd, &value, sizeof(value)) : write(fd, &value, 1);
+            break;
+        default:
+            ret = -1;
+            break;
+        }
+        if (ret < 0) {
+            t->err = errno;
+            break;
+        }
+        t->ops++;
+    }
+
+    pthread_barrier_wait(&barrier);     /* 结束，主线程读统计后才 close */
+    pthread_barrier_wait(&barrier);
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+/* 直方图格子上界，与驱动的 lb_bucket 对应 */
+static unsigned long long bucket_ns(int idx)
+{
+    int b = 0;
+
+    if (idx < 4) {
+        return idx;
+    }
+    b = idx / 4 + 1;
+    return ((5ULL + idx % 4) << (b - 2)) - 1;
+}
+
+static unsigned long long hist_pct(struct lockbench_stats *st, double p)
+{
+    unsigned long long want = 0;
+    unsigned long long seen = 0;
+    int i = 0;
+
+    if (st->ops == 0) {
+        return 0;
+    }
+    want = (unsigned long long)(p * st->ops);
+    for (i = 0; i < LB_BUCKETS; i++) {
+        seen += st->hist[i];
+        if (seen > want) {
+            return bucket_ns(i);
+        }
+    }
+    return st->max_ns;
+}
+
+static int run_one(int ctl, int prim, int load, int nthreads, unsigned int hold_ns)
+{
+    struct bench_thread t[MAX_THREADS];
+    struct lockbench_stats st;
+    unsigned long long ops = 0;
+    unsigned long long min_ops = ~0ULL;
+    unsigned long long max_ops = 0;
+    unsigned long long t0 = 0;
+    double sum = 0.0;
+    double sum2 = 0.0;
+    double secs = 0.0;
+    __u32 val = prim;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int err = 0;
+    int i = 0;
+
+    if (ioctl(ctl, LOCKBENCH_MODE_CMD, &val) < 0 ||
+        ioctl(ctl, LOCKBENCH_HOLD_CMD, &hold_ns) < 0) {
+        fprintf(stderr, "configure %s failed: %s\n", prim_names[prim], strerror(errno));
+        return -1;
+    }
+
+    memset(t, 0, sizeof(t));
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    running = 1;
+
+    for (i = 0; i < nthreads; i++) {
+        t[i].cpu = i % (ncpu > 0 ? ncpu : 1);
+        t[i].load = load;
+        pthread_create(&t[i].tid, NULL, bench_worker, &t[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    ioctl(ctl, LOCKBENCH_RESET_CMD);    /* 去掉线程准备阶段的 open */
+    t0 = now_ns();
+    pthread_barrier_wait(&barrier);
+    usleep(duration_ms * 1000);
+    running = 0;
+    pthread_barrier_wait(&barrier);
+    secs = (now_ns() - t0) / 1e9;
+    memset(&st, 0, sizeof(st));
+    ioctl(ctl, LOCKBENCH_STATS_CMD, &st);
+    pthread_barrier_wait(&barrier);
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(t[i].tid, NULL);
+        if (t[i].err && !err) {
+            err = t[i].err;
+        }
+        ops += t[i].ops;
+        sum += t[i].ops;
+        sum2 += (double)t[i].ops * t[i].ops;
+        if (t[i].ops < min_ops) {
+            min_ops = t[i].ops;
+        }
+        if (t[i].ops > max_ops) {
+            max_ops = t[i].ops;
+        }
+    }
+    pthread_barrier_destroy(&barrier);
+
+    if (err) {
+        fprintf(stderr, "%s %s threads=%d: %s\n",
+                prim_names[prim], load_names[load], nthreads, strerror(err));
+        if (ops == 0) {
+            return -1;
+        }
+    }
+
+    printf("%s,%s,%d,%u,%llu,%.3f,%.0f,%.4f,%.4f,%llu,%llu,%llu,%llu\n",
+           prim_names[prim], load_names[load], nthreads, hold_ns, ops, secs,
+           ops / secs, sum2 > 0 ? sum * sum / (nthreads * sum2) : 0.0,
+           max_ops ? (double)min_ops / max_ops : 0.0,
+           hist_pct(&st, 0.50), hist_pct(&st, 0.99), st.max_ns, st.retries);
+    fflush(stdout);
+
+    return 0;
+}
+
+static int parse_names(char *arg, const char **names, int count, int *out)
+{
+    char *tok = NULL;
+    int cnt = 0;
+    int i = 0;
+
+    for (tok = strtok(arg, ","); tok && cnt < count; tok = strtok(NULL, ",")) {
+        for (i = 0; i < count; i++) {
+            if (strcmp(tok, names[i]) == 0) {
+                break;
+            }
+        }
+        if (i == count) {
+            printf("unknown name %s\n", tok);
+            return -1;
+        }
+        out[cnt++] = i;
+    }
+    return cnt;
+}
+
+static int parse_threads(char *arg, int *threads)
+{
+    char *tok = NULL;
+    int cnt = 0;
+
+    for (tok = strtok(arg, ","); tok && cnt < MAX_THREADS; tok = strtok(NULL, ",")) {
+        threads[cnt] = atoi(tok);
+        if (threads[cnt] < 1 || threads[cnt] > MAX_THREADS) {
+            printf("threads out of range.\n");
+            return -1;
+        }
+        cnt++;
+    }
+    return cnt;
+}
+
+int main(int argc, char *argv[])
+{
+    int prims[PRIM_COUNT] = { 0, 1, 2, 3, 4 };
+    int nprims = PRIM_COUNT;
+    int loads[LOAD_COUNT] = { LOAD_OPEN, LOAD_WRITE, LOAD_READ, LOAD_MIX };
+    int nloads = LOAD_COUNT;
+    int threads[MAX_THREADS] = { 1, 2, 4 };
+    int nthreads = 3;
+    unsigned int hold_ns = 0;
+    int ctl = -1;
+    int opt = 0;
+    int p = 0;
+    int w = 0;
+    int i = 0;
+
+    while ((opt = getopt(argc, argv, "d:p:w:t:H:r:T:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dev_path = optarg;
+            break;
+        case 'p':
+            nprims = parse_names(optarg, prim_names, PRIM_COUNT, prims);
+            break;
+        case 'w':
+            nloads = parse_names(optarg, load_names, LOAD_COUNT, loads);
+            break;
+        case 't':
+            nthreads = parse_threads(optarg, threads);
+            break;
+        case 'H':
+            hold_ns = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            read_pct = strtoul(optarg, NULL, 0);
+            break;
+        case 'T':
+            duration_ms = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            printf("usage: %s [-d dev] [-p prims] [-w loads] [-t threads] [-H ns] [-r pct] [-T ms]\n",
+                   argv[0]);
+            return -1;
+        }
+    }
+    if (nprims <= 0 || nloads <= 0 || nthreads <= 0 || read_pct > 100) {
+        printf("param out of range.\n");
+        return -1;
+    }
+
+    /* 控制用 fd，切换原语与读统计 */
+    ctl = open(dev_path, O_RDWR);
+    if (ctl < 0) {
+        printf("open %s failed: %s.\n", dev_path, strerror(errno));
+        return -1;
+    }
+
+    printf("primitive,load,threads,hold_ns,ops,seconds,ops_per_s,fairness,min_max,"
+           "acq_p50_ns,acq_p99_ns,acq_max_ns,seq_retries\n");
+    for (p = 0; p < nprims; p++) {
+        for (w = 0; w < nloads; w++) {
+            for (i = 0; i < nthreads; i++) {
+                run_one(ctl, prims[p], loads[w], threads[i], hold_ns);
+            }
+        }
+    }
+
+    close(ctl);
+    return 0;
+}
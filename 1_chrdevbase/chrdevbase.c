@@ -3,77 +3,779 @@
 #include <linux/init.h>
 #include <linux/fs.h>
 #include <linux/uaccess.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/radix-tree.h>
+#include <linux/highmem.h>
+#include <linux/spinlock.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+
+#include "../common/fop_stats.h"
 
-#define CHRDEVBASE_MAJOR 200            // 主设备号
 #define CHRDEVBASE_NAME "chrdevbase"    // 名字
+#define CHRDEVBASE_MAX_MINORS 256
+
+#define DMABUF_EXPORT_CMD   _IOR(0xEE, 1, int)  // 导出数据缓冲为 dma-buf，返回 fd
+#define STORE_DISCARD_CMD   _IOW(0xEE, 2, struct store_range)   // 释放区间内的整页
+#define STORE_INFO_CMD      _IOR(0xEE, 3, struct store_info)    // 查询容量与驻留页数
+
+struct store_range {
+    __u64 offset;
+    __u64 len;
+};
+
+struct store_info {
+    __u64 size;             /* 容量，字节 */
+    __u64 resident_pages;   /* 已分配的页数 */
+};
+
+static unsigned int minors = 1;                 // 次设备号个数，每个都是独立的通道
+module_param(minors, uint, 0444);
+MODULE_PARM_DESC(minors, "number of independent channels (minors)");
+
+static unsigned int buf_size = PAGE_SIZE;       // 每个会话的数据缓冲大小，按页对齐
+module_param(buf_size, uint, 0444);
+MODULE_PARM_DESC(buf_size, "per-open data buffer size in bytes (page aligned)");
+
+static unsigned long store_size;                 // 非 0 时每个通道作为稀疏 RAM 存储，通道内所有打开共享
+module_param(store_size, ulong, 0444);
+MODULE_PARM_DESC(store_size, "sparse RAM store size in bytes, 0 = per-open buffers");
 
-static char writeBuf[100] = { 0 };      // 写缓冲
 static const char kerneldata[] = "This is kernel data!";
 
+/* 稀疏 RAM 存储，页在写入或 mmap 缺页时才分配 */
+struct chrdevbase_store {
+    spinlock_t lock;            /* 保护 pages */
+    struct radix_tree_root pages;
+    atomic_long_t nr_pages;     /* 驻留页数 */
+};
+
+/* 通道，每个次设备号一个，存储与统计互相独立 */
+struct chrdevbase_chan {
+    struct chrdevbase_store store;
+    struct device *device;
+    atomic_long_t opens;
+    atomic_long_t reads;
+    atomic_long_t writes;
+    atomic_long_t read_bytes;
+    atomic_long_t write_bytes;
+    atomic_long_t faults;   /* copy_to_user/copy_from_user 失败 */
+};
+
+/* chrdevbase 设备结构体 */
+struct chrdevbase_dev {
+    dev_t devid;            /* 设备号 */
+    int major;              /* 主设备号 */
+    int minor;              /* 次设备号 */
+    struct cdev cdev;       /* 字符设备，覆盖全部次设备号 */
+    struct class *class;    /* 类 */
+    struct chrdevbase_chan *chans;
+};
+
+static struct chrdevbase_dev chrdevbase;
+
+/* 每次 open 的会话，kref 计数，导出的 dma-buf 也持有一份引用 */
+struct chrdevbase_session {
+    struct kref ref;
+    struct chrdevbase_chan *chan;
+    struct mutex lock;  /* 保护 buf 的延迟分配 */
+    char *buf;          /* 首次写入或导出时分配，vmalloc_user 以便 mmap */
+};
+
+static struct kmem_cache *session_cache;
+
+static void session_free(struct kref *ref)
+{
+    struct chrdevbase_session *s = container_of(ref, struct chrdevbase_session, ref);
+
+    vfree(s->buf);
+    kmem_cache_free(session_cache, s);
+}
+
+static void session_put(struct chrdevbase_session *s)
+{
+    kref_put(&s->ref, session_free);
+}
+
+/* 取得会话缓冲，没有则分配，初始内容为 kerneldata */
+static char *session_get_buf(struct chrdevbase_session *s)
+{
+    char *buf = NULL;
+
+    mutex_lock(&s->lock);
+    if (!s->buf) {
+        buf = vmalloc_user(buf_size);
+        if (buf) {
+            memcpy(buf, kerneldata, sizeof(kerneldata));
+        }
+        /* 与 read 中的 smp_load_acquire 配对 */
+        smp_store_release(&s->buf, buf);
+    }
+    mutex_unlock(&s->lock);
+
+    return s->buf;
+}
+
+/* dma-buf 导出者回调，priv 为会话，dma-buf 释放时放掉会话引用 */
+static struct sg_table *chrdevbase_map_dma_buf(struct dma_buf_attachment *attach,
+                                               enum dma_data_direction dir)
+{
+    struct chrdevbase_session *s = attach->dmabuf->priv;
+    struct sg_table *sgt = NULL;
+    struct scatterlist *sg = NULL;
+    unsigned int npages = buf_size >> PAGE_SHIFT;
+    unsigned int i = 0;
+    int ret = 0;
+
+    sgt = kzalloc(sizeof(*sgt), GFP_KERNEL);
+    if (!sgt) {
+        return ERR_PTR(-ENOMEM);
+    }
+
+    ret = sg_alloc_table(sgt, npages, GFP_KERNEL);
+    if (ret < 0) {
+        kfree(sgt);
+        return ERR_PTR(ret);
+    }
+
+    for_each_sg(sgt->sgl, sg, npages, i) {
+        sg_set_page(sg, vmalloc_to_page(s->buf + i * PAGE_SIZE), PAGE_SIZE, 0);
+    }
+
+    if (!dma_map_sg(attach->dev, sgt->sgl, sgt->nents, dir)) {
+        sg_free_table(sgt);
+        kfree(sgt);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    return sgt;
+}
+
+static void chrdevbase_unmap_dma_buf(struct dma_buf_attachment *attach,
+                                     struct sg_table *sgt, enum dma_data_direction dir)
+{
+    dma_unmap_sg(attach->dev, sgt->sgl, sgt->nents, dir);
+    sg_free_table(sgt);
+    kfree(sgt);
+}
+
+static void chrdevbase_dmabuf_release(struct dma_buf *dmabuf)
+{
+    session_put(dmabuf->priv);
+}
+
+static void *chrdevbase_dmabuf_kmap(struct dma_buf *dmabuf, unsigned long pgnum)
+{
+    struct chrdevbase_session *s = dmabuf->priv;
+
+    return s->buf + pgnum * PAGE_SIZE;
+}
+
+static void *chrdevbase_dmabuf_vmap(struct dma_buf *dmabuf)
+{
+    struct chrdevbase_session *s = dmabuf->priv;
+
+    return s->buf;
+}
+
+static int chrdevbase_dmabuf_mmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
+{
+    struct chrdevbase_session *s = dmabuf->priv;
+
+    return remap_vmalloc_range(vma, s->buf, vma->vm_pgoff);
+}
+
+static const struct dma_buf_ops chrdevbase_dmabuf_ops = {
+    .map_dma_buf = chrdevbase_map_dma_buf,
+    .unmap_dma_buf = chrdevbase_unmap_dma_buf,
+    .release = chrdevbase_dmabuf_release,
+    .kmap_atomic = chrdevbase_dmabuf_kmap,
+    .kmap = chrdevbase_dmabuf_kmap,
+    .vmap = chrdevbase_dmabuf_vmap,
+    .mmap = chrdevbase_dmabuf_mmap,
+};
+
+static int chrdevbase_export_dmabuf(struct chrdevbase_session *s)
+{
+    DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+    struct dma_buf *dmabuf = NULL;
+    int fd = 0;
+
+    if (!session_get_buf(s)) {
+        return -ENOMEM;
+    }
+
+    exp_info.ops = &chrdevbase_dmabuf_ops;
+    exp_info.size = buf_size;
+    exp_info.flags = O_RDWR;
+    exp_info.priv = s;
+
+    kref_get(&s->ref);  /* 由 dma-buf 持有，release 回调中释放 */
+    dmabuf = dma_buf_export(&exp_info);
+    if (IS_ERR(dmabuf)) {
+        printk("dma_buf_export failed.\n");
+        session_put(s);
+        return PTR_ERR(dmabuf);
+    }
+
+    fd = dma_buf_fd(dmabuf, O_CLOEXEC);
+    if (fd < 0) {
+        dma_buf_put(dmabuf);
+    }
+
+    return fd;
+}
+
+/* 查找页并加引用，create 为真时不存在则分配，调用者负责 put_page */
+static struct page *store_get_page(struct chrdevbase_store *st, pgoff_t idx, bool create)
+{
+    struct page *page = NULL;
+    struct page *newpage = NULL;
+
+    spin_lock(&st->lock);
+    page = radix_tree_lookup(&st->pages, idx);
+    if (page) {
+        get_page(page);
+    }
+    spin_unlock(&st->lock);
+    if (page || !create) {
+        return page;
+    }
+
+    newpage = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+    if (!newpage) {
+        return NULL;
+    }
+    if (radix_tree_preload(GFP_KERNEL)) {
+        __free_page(newpage);
+        return NULL;
+    }
+
+    spin_lock(&st->lock);
+    page = radix_tree_lookup(&st->pages, idx);
+    if (!page) {    /* 期间没有被别人插入 */
+        newpage->index = idx;
+        radix_tree_insert(&st->pages, idx, newpage);
+        atomic_long_inc(&st->nr_pages);
+        page = newpage;
+        newpage = NULL;
+    }
+    get_page(page);
+    spin_unlock(&st->lock);
+    radix_tree_preload_end();
+
+    if (newpage) {
+        __free_page(newpage);
+    }
+    return page;
+}
+
+/* 从树中摘除 [first, last] 内的页，通过 lru 链到 freelist 上 */
+static void store_remove_pages(struct chrdevbase_store *st, pgoff_t first, pgoff_t last, struct list_head *freelist)
+{
+#define FREE_BATCH 16
+    struct page *pages[FREE_BATCH];
+    pgoff_t idx = first;
+    int nr = 0;
+    int i = 0;
+
+    spin_lock(&st->lock);
+    do {
+        nr = radix_tree_gang_lookup(&st->pages, (void **)pages, idx, FREE_BATCH);
+        for (i = 0; i < nr; i++) {
+            idx = pages[i]->index;
+            if (idx > last) {
+                nr = 0;
+                break;
+            }
+            radix_tree_delete(&st->pages, idx);
+            atomic_long_dec(&st->nr_pages);
+            list_add(&pages[i]->lru, freelist);
+        }
+        idx++;
+    } while (nr == FREE_BATCH && idx != 0);
+    spin_unlock(&st->lock);
+}
+
+static void store_free_list(struct list_head *freelist)
+{
+    struct page *page = NULL;
+    struct page *tmp = NULL;
+
+    list_for_each_entry_safe(page, tmp, freelist, lru) {
+        list_del(&page->lru);
+        put_page(page); /* 仍被映射或读写中的页在最后一个引用释放时回收 */
+    }
+}
+
+static int store_discard(struct chrdevbase_store *st, struct file *filp, struct store_range *range)
+{
+    LIST_HEAD(freelist);
+    pgoff_t first = 0;
+    pgoff_t last = 0;
+    u64 end = 0;
+
+    if (range->offset >= store_size || range->len == 0) {
+        return -EINVAL;
+    }
+    end = min_t(u64, range->offset + range->len, store_size);
+
+    /* 只释放区间内完整的页 */
+    first = DIV_ROUND_UP_ULL(range->offset, PAGE_SIZE);
+    if (end == store_size) {
+        end = PAGE_ALIGN(end);
+    }
+    if ((end >> PAGE_SHIFT) <= first) {
+        return 0;
+    }
+    last = (end >> PAGE_SHIFT) - 1;
+
+    store_remove_pages(st, first, last, &freelist);
+    unmap_mapping_range(filp->f_mapping, (loff_t)first << PAGE_SHIFT,
+                        (loff_t)(last - first + 1) << PAGE_SHIFT, 1);
+    store_free_list(&freelist);
+
+    return 0;
+}
+
+static ssize_t store_read(struct chrdevbase_store *st, char __user *buf,
+                          size_t cnt, loff_t *offt)
+{
+    struct page *page = NULL;
+    size_t done = 0;
+    size_t off = 0;
+    size_t len = 0;
+    void *vaddr = NULL;
+    int ret = 0;
+
+    if (*offt >= store_size) {
+        return 0;
+    }
+    cnt = min_t(size_t, cnt, store_size - *offt);
+
+    while (done < cnt) {
+        off = (*offt + done) & ~PAGE_MASK;
+        len = min_t(size_t, cnt - done, PAGE_SIZE - off);
+
+        page = store_get_page(st, (*offt + done) >> PAGE_SHIFT, false);
+        if (page) {
+            vaddr = kmap(page);
+            ret = copy_to_user(buf + done, vaddr + off, len);
+            kunmap(page);
+            put_page(page);
+        } else {    /* 空洞读为 0 */
+            ret = clear_user(buf + done, len);
+        }
+        if (ret) {
+            break;
+        }
+        done += len;
+    }
+
+    if (done == 0 && ret) {
+        return -EFAULT;
+    }
+    *offt += done;
+    return done;
+}
+
+static ssize_t store_write(struct chrdevbase_store *st, const char __user *buf,
+                           size_t cnt, loff_t *offt)
+{
+    struct page *page = NULL;
+    size_t done = 0;
+    size_t off = 0;
+    size_t len = 0;
+    void *vaddr = NULL;
+    int ret = 0;
+
+    if (*offt >= store_size) {
+        return -ENOSPC;
+    }
+    cnt = min_t(size_t, cnt, store_size - *offt);
+
+    while (done < cnt) {
+        off = (*offt + done) & ~PAGE_MASK;
+        len = min_t(size_t, cnt - done, PAGE_SIZE - off);
+
+        page = store_get_page(st, (*offt + done) >> PAGE_SHIFT, true);
+        if (!page) {
+            ret = -ENOMEM;
+            break;
+        }
+        vaddr = kmap(page);
+        ret = copy_from_user(vaddr + off, buf + done, len) ? -EFAULT : 0;
+        kunmap(page);
+        put_page(page);
+        if (ret) {
+            break;
+        }
+        done += len;
+    }
+
+    if (done == 0 && ret) {
+        return ret;
+    }
+    *offt += done;
+    return done;
+}
+
+static int store_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
+{
+    struct chrdevbase_session *s = vma->vm_file->private_data;
+    struct page *page = NULL;
+
+    if (vmf->pgoff >= DIV_ROUND_UP(store_size, PAGE_SIZE)) {
+        return VM_FAULT_SIGBUS;
+    }
+
+    page = store_get_page(&s->chan->store, vmf->pgoff, true);
+    if (!page) {
+        return VM_FAULT_OOM;
+    }
+    vmf->page = page;   /* 引用交给缺页处理 */
+
+    return 0;
+}
+
+static const struct vm_operations_struct store_vm_ops = {
+    .fault = store_fault,
+};
+
+static void store_init(struct chrdevbase_store *st)
+{
+    spin_lock_init(&st->lock);
+    INIT_RADIX_TREE(&st->pages, GFP_ATOMIC);
+    atomic_long_set(&st->nr_pages, 0);
+}
+
+static void store_destroy(struct chrdevbase_store *st)
+{
+    LIST_HEAD(freelist);
+
+    store_remove_pages(st, 0, ULONG_MAX, &freelist);
+    store_free_list(&freelist);
+}
+
 static int chrdevbase_open(struct inode *inode, struct file *filp)
 {
-    // printk("chrdevbase_open\n");
+    struct chrdevbase_dev *dev = container_of(inode->i_cdev, struct chrdevbase_dev, cdev);
+    struct chrdevbase_session *s = NULL;
+
+    s = kmem_cache_alloc(session_cache, GFP_KERNEL);
+    if (!s) {
+        return -ENOMEM;
+    }
+    kref_init(&s->ref);
+    mutex_init(&s->lock);
+    s->buf = NULL;
+    s->chan = &dev->chans[iminor(inode) - dev->minor];
+    atomic_long_inc(&s->chan->opens);
+
+    filp->private_data = s;
     return 0;
 }
 
-static ssize_t chrdevbase_read(struct file *filp, char __user *buf,     
+static ssize_t chrdevbase_read(struct file *filp, char __user *buf,
                                size_t cnt, loff_t *offt)
 {
-    int ret = 0;
+    struct chrdevbase_session *s = filp->private_data;
+    const char *src = NULL;
+    size_t size = 0;
+    ssize_t ret = 0;
+
+    atomic_long_inc(&s->chan->reads);
+    if (store_size) {
+        ret = store_read(&s->chan->store, buf, cnt, offt);
+        if (ret > 0) {
+            atomic_long_add(ret, &s->chan->read_bytes);
+        }
+        return ret;
+    }
 
-    ret = copy_to_user(buf, kerneldata, sizeof(kerneldata));
+    /* 尚未写入过的会话返回 kerneldata，不为只读的打开分配缓冲 */
+    src = smp_load_acquire(&s->buf);
+    size = src ? buf_size : sizeof(kerneldata);
+    if (!src) {
+        src = kerneldata;
+    }
+
+    if (*offt >= size) {
+        return 0;
+    }
+    cnt = min_t(size_t, cnt, size - *offt);
+
+    ret = copy_to_user(buf, src + *offt, cnt);
     if (ret != 0) {
-        printk("copy_to_user failed.\n");
+        atomic_long_inc(&s->chan->faults);
+        dev_dbg_ratelimited(s->chan->device, "copy_to_user failed.\n");
+        return -EFAULT;
     }
-    
-    return 0;
+    *offt += cnt;
+    atomic_long_add(cnt, &s->chan->read_bytes);
+
+    return cnt;
 }
 
-static ssize_t chrdevbase_write(struct file *filp, const char __user *buf,  
+static ssize_t chrdevbase_write(struct file *filp, const char __user *buf,
                                 size_t cnt, loff_t *offt)
 {
-    int ret = 0;
+    struct chrdevbase_session *s = filp->private_data;
+    char *dst = NULL;
+    ssize_t ret = 0;
 
-    ret = copy_from_user(writeBuf, buf, cnt);
+    atomic_long_inc(&s->chan->writes);
+    if (store_size) {
+        ret = store_write(&s->chan->store, buf, cnt, offt);
+        if (ret > 0) {
+            atomic_long_add(ret, &s->chan->write_bytes);
+        }
+        return ret;
+    }
+
+    if (*offt >= buf_size) {
+        return -ENOSPC;
+    }
+    cnt = min_t(size_t, cnt, buf_size - *offt);
+
+    dst = session_get_buf(s);
+    if (!dst) {
+        return -ENOMEM;
+    }
+
+    ret = copy_from_user(dst + *offt, buf, cnt);
     if (ret != 0) {
-        printk("copy_from_user failed.\n");
+        atomic_long_inc(&s->chan->faults);
+        dev_dbg_ratelimited(s->chan->device, "copy_from_user failed.\n");
+        return -EFAULT;
+    }
+    dev_dbg_ratelimited(s->chan->device, "kernel revedata:%.*s\n", (int)cnt, dst + *offt);
+    *offt += cnt;
+    atomic_long_add(cnt, &s->chan->write_bytes);
+
+    return cnt;
+}
+
+static long chrdevbase_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct chrdevbase_session *s = filp->private_data;
+    struct store_range range;
+    struct store_info info;
+    int fd = 0;
+
+    switch (cmd)
+    {
+    case DMABUF_EXPORT_CMD:
+        if (store_size) {   /* 存储页不连续且可被丢弃，不导出 */
+            return -EINVAL;
+        }
+        fd = chrdevbase_export_dmabuf(s);
+        if (fd < 0) {
+            return fd;
+        }
+        if (copy_to_user((int __user *)arg, &fd, sizeof(fd))) {
+            return -EFAULT;
+        }
+        break;
+    case STORE_DISCARD_CMD:
+        if (!store_size) {
+            return -EINVAL;
+        }
+        if (copy_from_user(&range, (void __user *)arg, sizeof(range))) {
+            return -EFAULT;
+        }
+        return store_discard(&s->chan->store, filp, &range);
+    case STORE_INFO_CMD:
+        info.size = store_size ? store_size : buf_size;
+        info.resident_pages = atomic_long_read(&s->chan->store.nr_pages);
+        if (copy_to_user((void __user *)arg, &info, sizeof(info))) {
+            return -EFAULT;
+        }
+        break;
+    default:
+        return -ENOTTY;
     }
-    printk("kernel revedata:%s\n", writeBuf);
 
     return 0;
 }
 
+static loff_t chrdevbase_llseek(struct file *filp, loff_t off, int whence)
+{
+    return fixed_size_llseek(filp, off, whence, store_size ? store_size : buf_size);
+}
+
+static int chrdevbase_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    if (!store_size) {  /* 会话缓冲通过导出的 dma-buf 映射 */
+        return -ENODEV;
+    }
+
+    vma->vm_ops = &store_vm_ops;
+    return 0;
+}
+
 static int chrdevbase_release(struct inode *inode, struct file *filp)
 {
     // printk("chrdevbase_release\n");
+    session_put(filp->private_data);    /* 导出的 dma-buf 仍可能持有会话 */
     return 0;
 }
 
-static struct file_operations chrdevbase_fops = { 
-    .owner = THIS_MODULE, 
-    .open = chrdevbase_open, 
-    .read = chrdevbase_read, 
-    .write = chrdevbase_write, 
-    .release = chrdevbase_release, 
+static struct file_operations chrdevbase_fops = {
+    .owner = THIS_MODULE,
+    .llseek = chrdevbase_llseek,
+    .open = chrdevbase_open,
+    .read = chrdevbase_read,
+    .write = chrdevbase_write,
+    .unlocked_ioctl = chrdevbase_ioctl,
+    .mmap = chrdevbase_mmap,
+    .release = chrdevbase_release,
+};
+
+/* 通道统计，/sys/class/chrdevbase/<dev>/stats */
+static ssize_t stats_show(struct device *device, struct device_attribute *attr, char *buf)
+{
+    struct chrdevbase_chan *chan = dev_get_drvdata(device);
+
+    return sprintf(buf, "opens %ld\nreads %ld\nwrites %ld\nread_bytes %ld\nwrite_bytes %ld\nresident_pages %ld\nfaults %ld\n",
+                   atomic_long_read(&chan->opens), atomic_long_read(&chan->reads),
+                   atomic_long_read(&chan->writes), atomic_long_read(&chan->read_bytes),
+                   atomic_long_read(&chan->write_bytes), atomic_long_read(&chan->store.nr_pages),
+                   atomic_long_read(&chan->faults));
+}
+static DEVICE_ATTR_RO(stats);
+
+static struct attribute *chrdevbase_attrs[] = {
+    &dev_attr_stats.attr,
+    NULL,
 };
+ATTRIBUTE_GROUPS(chrdevbase);
+
+static void chrdevbase_destroy_chans(unsigned int cnt)
+{
+    unsigned int i = 0;
+
+    for (i = 0; i < cnt; i++) {
+        device_destroy(chrdevbase.class, MKDEV(chrdevbase.major, chrdevbase.minor + i));
+        store_destroy(&chrdevbase.chans[i].store);
+    }
+}
 
 static int __init chrdevbase_init(void)
 {
     int ret = 0;
+    unsigned int i = 0;
+    struct chrdevbase_chan *chan = NULL;
 
     printk("chrdevbase_init\n");
 
-    ret = register_chrdev(CHRDEVBASE_MAJOR, CHRDEVBASE_NAME, &chrdevbase_fops);
+    if (minors == 0 || minors > CHRDEVBASE_MAX_MINORS) {
+        printk("minors out of range.\n");
+        return -EINVAL;
+    }
+    buf_size = PAGE_ALIGN(max_t(unsigned int, buf_size, sizeof(kerneldata)));
+
+    /* 会话对象缓存 */
+    session_cache = KMEM_CACHE(chrdevbase_session, SLAB_HWCACHE_ALIGN);
+    if (!session_cache) {
+        printk("kmem_cache_create failed.\n");
+        return -ENOMEM;
+    }
+
+    chrdevbase.chans = kcalloc(minors, sizeof(*chrdevbase.chans), GFP_KERNEL);
+    if (!chrdevbase.chans) {
+        ret = -ENOMEM;
+        goto fail_chans;
+    }
+
+    /* 申请设备号，由内核分配 */
+    ret = alloc_chrdev_region(&chrdevbase.devid, 0, minors, CHRDEVBASE_NAME);
     if (ret < 0) {
-        printk("chrdevbase init failed.\n");
+        printk("alloc_chrdev_region failed.\n");
+        goto fail_devid;
+    }
+    chrdevbase.major = MAJOR(chrdevbase.devid);
+    chrdevbase.minor = MINOR(chrdevbase.devid);
+    printk("chrdevbase major=%d, minor=%d, count=%u\n", chrdevbase.major, chrdevbase.minor, minors);
+
+    /* 添加字符设备 */
+    chrdevbase.cdev.owner = THIS_MODULE;
+    cdev_init(&chrdevbase.cdev, fop_stats_init(CHRDEVBASE_NAME, &chrdevbase_fops));
+    ret = cdev_add(&chrdevbase.cdev, chrdevbase.devid, minors);
+    if (ret < 0) {
+        printk("cdev_add failed.\n");
+        goto fail_cdev;
+    }
+
+    /* 创建类 */
+    chrdevbase.class = class_create(THIS_MODULE, CHRDEVBASE_NAME);
+    if (IS_ERR(chrdevbase.class)) {
+        ret = PTR_ERR(chrdevbase.class);
+        printk("class_create failed.\n");
+        goto fail_class;
+    }
+
+    /* 每个通道一个设备，只有一个通道时沿用 /dev/chrdevbase */
+    for (i = 0; i < minors; i++) {
+        chan = &chrdevbase.chans[i];
+        store_init(&chan->store);
+        if (minors == 1) {
+            chan->device = device_create_with_groups(chrdevbase.class, NULL,
+                    MKDEV(chrdevbase.major, chrdevbase.minor + i), chan,
+                    chrdevbase_groups, CHRDEVBASE_NAME);
+        } else {
+            chan->device = device_create_with_groups(chrdevbase.class, NULL,
+                    MKDEV(chrdevbase.major, chrdevbase.minor + i), chan,
+                    chrdevbase_groups, CHRDEVBASE_NAME "%u", i);
+        }
+        if (IS_ERR(chan->device)) {
+            ret = PTR_ERR(chan->device);
+            printk("device_create failed.\n");
+            goto fail_device;
+        }
+    }
+    if (store_size) {
+        printk("chrdevbase store size = %lu per channel\n", store_size);
     }
 
     return 0;
+
+fail_device:
+    chrdevbase_destroy_chans(i);
+    class_destroy(chrdevbase.class);
+fail_class:
+    cdev_del(&chrdevbase.cdev);
+fail_cdev:
+    fop_stats_exit();
+    unregister_chrdev_region(chrdevbase.devid, minors);
+fail_devid:
+    kfree(chrdevbase.chans);
+fail_chans:
+    kmem_cache_destroy(session_cache);
+    return ret;
 }
 
 static void __exit chrdevbase_exit(void)
 {
-    unregister_chrdev(CHRDEVBASE_MAJOR, CHRDEVBASE_NAME);
+    /* 销毁设备并释放各通道的存储 */
+    chrdevbase_destroy_chans(minors);
+    /* 销毁类 */
+    class_destroy(chrdevbase.class);
+    /* 删除字符设备 */
+    cdev_del(&chrdevbase.cdev);
+    fop_stats_exit();
+    /* 释放设备号 */
+    unregister_chrdev_region(chrdevbase.devid, minors);
+
+    kfree(chrdevbase.chans);
+    kmem_cache_destroy(session_cache);
     printk("chrdevbase_exit\n");
 }
 
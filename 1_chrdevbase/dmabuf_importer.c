@@ -0,0 +1,225 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/scatterlist.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+
+/*
+ * chrdevbase 导出的 dma-buf 的测试导入者。走内核消费者的路径：
+ * dma_buf_attach、dma_buf_map_attachment 取得 sg 表，再按 sg 表逐字节核对内容，
+ * 验证导出者的 map_dma_buf/unmap_dma_buf。用法见 1_chrdevbase_app 的模式 4。
+ */
+
+#define DRIVER_CNT 1
+#define DRIVER_NAME "dmabuf_importer"
+
+#define DMABUF_CHECK_CMD    _IOWR(0xEE, 16, struct dmabuf_check)   // 导入 fd 并核对内容
+
+struct dmabuf_check {
+    __s32 fd;           /* chrdevbase 导出的 dma-buf */
+    __u32 len;          /* 核对的字节数，不超过 dma-buf 大小 */
+    __u32 seed;         /* 第 i 字节应为 (seed + i) & 0xFF */
+    __u32 nents;        /* 返回映射后的 sg 段数 */
+    __s64 mismatch;     /* 返回第一个不一致的偏移，-1 表示全部一致 */
+};
+
+/* 设备结构体 */
+struct importer_dev {
+    dev_t devid;
+    int major;
+    int minor;
+    struct cdev cdev;       /* 字符设备 */
+    struct class *class;    /* 类 */
+    struct device *device;  /* 设备，attach 时作为 DMA 设备 */
+};
+
+struct importer_dev importer;
+
+static int importer_check(struct dmabuf_check *chk)
+{
+    struct dma_buf *dmabuf = NULL;
+    struct dma_buf_attachment *attach = NULL;
+    struct sg_table *sgt = NULL;
+    struct sg_mapping_iter miter;
+    const u8 *p = NULL;
+    u64 off = 0;
+    size_t i = 0;
+    int ret = 0;
+
+    dmabuf = dma_buf_get(chk->fd);
+    if (IS_ERR(dmabuf)) {
+        return PTR_ERR(dmabuf);
+    }
+    if (chk->len > dmabuf->size) {
+        ret = -EINVAL;
+        goto fail_size;
+    }
+
+    attach = dma_buf_attach(dmabuf, importer.device);
+    if (IS_ERR(attach)) {
+        ret = PTR_ERR(attach);
+        goto fail_size;
+    }
+
+    sgt = dma_buf_map_attachment(attach, DMA_TO_DEVICE);
+    if (IS_ERR(sgt)) {
+        ret = PTR_ERR(sgt);
+        goto fail_map;
+    }
+    chk->nents = sgt->nents;
+    chk->mismatch = -1;
+
+    /* sg_miter 逐页 kmap，处理段内偏移与高端内存 */
+    sg_miter_start(&miter, sgt->sgl, sgt->orig_nents, SG_MITER_FROM_SG);
+    while (off < chk->len && chk->mismatch < 0 && sg_miter_next(&miter)) {
+        p = miter.addr;
+        for (i = 0; i < miter.length && off < chk->len; i++, off++) {
+            if (p[i] != (u8)(chk->seed + off)) {
+                chk->mismatch = off;
+                break;
+            }
+        }
+    }
+    sg_miter_stop(&miter);
+    /* sg 表比声明的大小短，同样算不一致 */
+    if (chk->mismatch < 0 && off < chk->len) {
+        chk->mismatch = off;
+    }
+
+    dma_buf_unmap_attachment(attach, sgt, DMA_TO_DEVICE);
+fail_map:
+    dma_buf_detach(dmabuf, attach);
+fail_size:
+    dma_buf_put(dmabuf);
+    return ret;
+}
+
+static int importer_open(struct inode *inode, struct file *filp)
+{
+    filp->private_data = &importer;
+    return 0;
+}
+
+static long importer_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct dmabuf_check chk;
+    int ret = 0;
+
+    switch (cmd)
+    {
+    case DMABUF_CHECK_CMD:
+        if (copy_from_user(&chk, (void __user *)arg, sizeof(chk))) {
+            return -EFAULT;
+        }
+        ret = importer_check(&chk);
+        if (ret < 0) {
+            return ret;
+        }
+        if (copy_to_user((void __user *)arg, &chk, sizeof(chk))) {
+            return -EFAULT;
+        }
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+static int importer_release(struct inode *inode, struct file *filp)
+{
+    return 0;
+}
+
+/* 字符设备操作集合 */
+static struct file_operations importer_fops = {
+    .owner = THIS_MODULE,
+    .open = importer_open,
+    .unlocked_ioctl = importer_ioctl,
+    .release = importer_release,
+};
+
+static int __init importer_init(void)
+{
+    int ret = 0;
+
+    /* 注册设备号 */
+    ret = alloc_chrdev_region(&importer.devid, 0, DRIVER_CNT, DRIVER_NAME);
+    if (ret < 0) {
+        printk("alloc_chrdev_region failed.\n");
+        goto fail_devid;
+    }
+    importer.major = MAJOR(importer.devid);
+    importer.minor = MINOR(importer.devid);
+    printk("dmabuf_importer major = %d, minor = %d\n", importer.major, importer.minor);
+
+    /* 添加字符设备 */
+    importer.cdev.owner = THIS_MODULE;
+    cdev_init(&importer.cdev, &importer_fops);
+    ret = cdev_add(&importer.cdev, importer.devid, DRIVER_CNT);
+    if (ret < 0) {
+        printk("cdev_add failed.\n");
+        goto fail_cdev;
+    }
+
+    /* 创建类 */
+    importer.class = class_create(THIS_MODULE, DRIVER_NAME);
+    if (IS_ERR(importer.class)) {
+        ret = PTR_ERR(importer.class);
+        printk("class_create failed.\n");
+        goto fail_class;
+    }
+
+    /* 创建设备 */
+    importer.device = device_create(importer.class, NULL, importer.devid, NULL, DRIVER_NAME);
+    if (IS_ERR(importer.device)) {
+        ret = PTR_ERR(importer.device);
+        printk("device_create failed.\n");
+        goto fail_device;
+    }
+
+    /* 类设备默认没有 DMA 掩码，dma_map_sg 需要 */
+    ret = dma_coerce_mask_and_coherent(importer.device, DMA_BIT_MASK(32));
+    if (ret) {
+        printk("dma_coerce_mask_and_coherent failed.\n");
+        goto fail_dma;
+    }
+
+    return 0;
+
+fail_dma:
+    /* 销毁设备 */
+    device_destroy(importer.class, importer.devid);
+fail_device:
+    /* 销毁类 */
+    class_destroy(importer.class);
+fail_class:
+    /* 删除字符设备 */
+    cdev_del(&importer.cdev);
+fail_cdev:
+    /* 释放设备号 */
+    unregister_chrdev_region(importer.devid, DRIVER_CNT);
+fail_devid:
+    return ret;
+}
+
+static void __exit importer_exit(void)
+{
+    /* 销毁设备 */
+    device_destroy(importer.class, importer.devid);
+    /* 销毁类 */
+    class_destroy(importer.class);
+    /* 删除字符设备 */
+    cdev_del(&importer.cdev);
+    /* 释放设备号 */
+    unregister_chrdev_region(importer.devid, DRIVER_CNT);
+}
+
+/* 模块入口与出口 */
+module_init(importer_init);
+module_exit(importer_exit);
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("wangpeng");
@@ -1,33 +1,250 @@
 /* 
 ./chrdevbase_app 1  // 表示从驱动里读数据
 ./chrdevbase_app 2  // 表示向驱动里写数据
+./chrdevbase_app 3  // 导出 dma-buf 并 mmap，与 read 的结果对比
+./chrdevbase_app 4  // 写入测试图案后导出 dma-buf，交给 dmabuf_importer 模块 attach/map 后核对
+./chrdevbase_app 5  // 稀疏存储：高偏移写入、mmap 读回、discard 后读为 0，核对驻留页数
+                    // 需以 store_size=<字节> 加载驱动，至少 4 页
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #define DEVICE_PATH "/dev/chrdevbase"
+#define IMPORTER_PATH "/dev/dmabuf_importer"
+#define DMABUF_EXPORT_CMD   _IOR(0xEE, 1, int)  // 导出数据缓冲为 dma-buf，返回 fd
+#define STORE_DISCARD_CMD   _IOW(0xEE, 2, struct store_range)   // 释放区间内的整页
+#define STORE_INFO_CMD      _IOR(0xEE, 3, struct store_info)    // 查询容量与驻留页数
+#define DMABUF_CHECK_CMD    _IOWR(0xEE, 16, struct dmabuf_check)   // 导入 fd 并核对内容
+
+#define PATTERN_SIZE (1024 * 1024)  /* 一次写满缓冲，驱动截断到 buf_size */
+#define PATTERN_SEED 0x5A
+
+struct store_range {
+    unsigned long long offset;
+    unsigned long long len;
+};
+
+struct store_info {
+    unsigned long long size;            /* 容量，字节 */
+    unsigned long long resident_pages;  /* 已分配的页数 */
+};
+
+struct dmabuf_check {
+    int fd;                 /* chrdevbase 导出的 dma-buf */
+    unsigned int len;       /* 核对的字节数 */
+    unsigned int seed;      /* 第 i 字节应为 (seed + i) & 0xFF */
+    unsigned int nents;     /* 返回映射后的 sg 段数 */
+    long long mismatch;     /* 返回第一个不一致的偏移，-1 表示全部一致 */
+};
+
 static const char userdata[] = "This is user data!";
 
+/* 模式 4，内核导入者经 sg 表核对写入的图案 */
+static int import_check(int fd)
+{
+    struct dmabuf_check chk;
+    unsigned char *pattern = NULL;
+    int dmabuf_fd = 0;
+    int imp_fd = 0;
+    int ret = 0;
+    int i = 0;
+
+    pattern = malloc(PATTERN_SIZE);
+    if (pattern == NULL) {
+        return -1;
+    }
+    for (i = 0; i < PATTERN_SIZE; i++) {
+        pattern[i] = (unsigned char)(PATTERN_SEED + i);
+    }
+    ret = write(fd, pattern, PATTERN_SIZE);
+    free(pattern);
+    if (ret <= 0) {
+        printf("write pattern failed.\n");
+        return -1;
+    }
+
+    memset(&chk, 0, sizeof(chk));
+    chk.len = ret;
+    chk.seed = PATTERN_SEED;
+    if (ioctl(fd, DMABUF_EXPORT_CMD, &dmabuf_fd) < 0) {
+        printf("export dmabuf failed.\n");
+        return -1;
+    }
+    chk.fd = dmabuf_fd;
+
+    imp_fd = open(IMPORTER_PATH, O_RDWR);
+    if (imp_fd < 0) {
+        printf("open %s failed.\n", IMPORTER_PATH);
+        close(dmabuf_fd);
+        return -1;
+    }
+    ret = ioctl(imp_fd, DMABUF_CHECK_CMD, &chk);
+    if (ret < 0) {
+        printf("import check failed: %s\n", strerror(errno));
+    } else if (chk.mismatch >= 0) {
+        printf("dmabuf mismatch at offset %lld of %u.\n", chk.mismatch, chk.len);
+        ret = -1;
+    } else {
+        printf("dmabuf import ok: %u bytes, %u sg entries\n", chk.len, chk.nents);
+    }
+
+    close(imp_fd);
+    close(dmabuf_fd);
+    return ret < 0 ? -1 : 0;
+}
+
+static int store_get_info(int fd, struct store_info *info)
+{
+    if (ioctl(fd, STORE_INFO_CMD, info) < 0) {
+        printf("STORE_INFO failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* 模式 5 的一页：read 与 mmap 都应读到 c */
+static int store_expect(int fd, char *page, char *map, long pg, off_t off, char c)
+{
+    long i = 0;
+
+    if (pread(fd, page, pg, off) != pg) {
+        printf("pread at %lld failed.\n", (long long)off);
+        return -1;
+    }
+    for (i = 0; i < pg; i++) {
+        if (page[i] != c || map[i] != c) {
+            printf("offset %lld: read %#x mmap %#x, want %#x\n",
+                   (long long)(off + i), page[i] & 0xFF, map[i] & 0xFF, c & 0xFF);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* 模式 5，只有一个打开者时驻留页数的变化才准确 */
+static int store_check(int fd)
+{
+    struct store_info info;
+    struct store_range range;
+    unsigned long long base = 0;
+    long pg = sysconf(_SC_PAGESIZE);
+    off_t off[2] = { 0, 0 };
+    char *map[2] = { NULL, NULL };
+    char *page = NULL;
+    int ret = -1;
+    int i = 0;
+
+    if (store_get_info(fd, &info) < 0) {
+        return -1;
+    }
+    if (info.size < 4 * (unsigned long long)pg) {
+        printf("store too small, load the driver with store_size.\n");
+        return -1;
+    }
+    /* fixed_size_llseek：SEEK_END 即容量 */
+    if (lseek(fd, 0, SEEK_END) != (off_t)info.size) {
+        printf("SEEK_END mismatch.\n");
+        return -1;
+    }
+
+    /* 中间一页与最后一个整页，先丢弃以便从空洞开始 */
+    off[0] = (info.size / 2) & ~(pg - 1);
+    off[1] = (info.size & ~(pg - 1)) - pg;
+    range.offset = off[0];
+    range.len = info.size - off[0];
+    if (ioctl(fd, STORE_DISCARD_CMD, &range) < 0) {
+        printf("STORE_DISCARD failed: %s\n", strerror(errno));
+        return -1;
+    }
+    if (store_get_info(fd, &info) < 0) {
+        return -1;
+    }
+    base = info.resident_pages;
+
+    page = malloc(pg);
+    if (page == NULL) {
+        return -1;
+    }
+    for (i = 0; i < 2; i++) {
+        memset(page, 'A' + i, pg);
+        if (pwrite(fd, page, pg, off[i]) != pg) {
+            printf("pwrite at %lld failed.\n", (long long)off[i]);
+            goto out;
+        }
+        map[i] = mmap(NULL, pg, PROT_READ, MAP_SHARED, fd, off[i]);
+        if (map[i] == MAP_FAILED) {
+            map[i] = NULL;
+            printf("mmap at %lld failed.\n", (long long)off[i]);
+            goto out;
+        }
+        if (store_expect(fd, page, map[i], pg, off[i], 'A' + i) < 0) {
+            goto out;
+        }
+    }
+    if (store_get_info(fd, &info) < 0) {
+        goto out;
+    }
+    if (info.resident_pages != base + 2) {
+        printf("resident pages %llu, want %llu\n", info.resident_pages, base + 2);
+        goto out;
+    }
+
+    /* 丢弃后映射被拆除，再次访问缺页得到新的零页 */
+    if (ioctl(fd, STORE_DISCARD_CMD, &range) < 0) {
+        printf("STORE_DISCARD failed: %s\n", strerror(errno));
+        goto out;
+    }
+    if (store_get_info(fd, &info) < 0) {
+        goto out;
+    }
+    if (info.resident_pages != base) {
+        printf("resident pages %llu after discard, want %llu\n", info.resident_pages, base);
+        goto out;
+    }
+    for (i = 0; i < 2; i++) {
+        if (store_expect(fd, page, map[i], pg, off[i], 0) < 0) {
+            goto out;
+        }
+    }
+    printf("store ok: size %llu, pages at %lld and %lld\n",
+           info.size, (long long)off[0], (long long)off[1]);
+    ret = 0;
+
+out:
+    for (i = 0; i < 2; i++) {
+        if (map[i]) {
+            munmap(map[i], pg);
+        }
+    }
+    free(page);
+    return ret;
+}
+
 int main(int argc, char* argv[])
 {
     int ret = 0;
     int fd = 0;
     char readbuf[100] = { 0 };
     unsigned char oper = 0;
+    int dmabuf_fd = 0;
+    char *map = NULL;
 
     if (argc != 2) {    // inlucde self
-        printf("need a param, 1=read, 2=write.\n");
+        printf("need a param, 1=read, 2=write, 3=dmabuf, 4=import, 5=store.\n");
         return -1;
     }
     
     oper = atoi(argv[1]);   // if param not number, atoi return 0
-    if (oper != 1 && oper != 2) {
+    if (oper < 1 || oper > 5) {
         printf("param out of range.\n");
         return -1;
     }
@@ -46,6 +263,43 @@ int main(int argc, char* argv[])
             return -1;
         }
         printf("read data: %s\n", readbuf);
+    } else if (oper == 4) {
+        ret = import_check(fd);
+        close(fd);
+        return ret;
+    } else if (oper == 5) {
+        ret = store_check(fd);
+        close(fd);
+        return ret;
+    } else if (oper == 3) {
+        ret = ioctl(fd, DMABUF_EXPORT_CMD, &dmabuf_fd);
+        if (ret < 0) {
+            printf("export dmabuf failed.\n");
+            close(fd);
+            return -1;
+        }
+
+        map = mmap(NULL, sizeof(readbuf), PROT_READ, MAP_SHARED, dmabuf_fd, 0);
+        if (map == MAP_FAILED) {
+            printf("mmap dmabuf failed.\n");
+            close(dmabuf_fd);
+            close(fd);
+            return -1;
+        }
+
+        ret = read(fd, readbuf, sizeof(readbuf) - 1);
+        if (ret < 0 || memcmp(map, readbuf, ret) != 0) {
+            printf("dmabuf data mismatch.\n");
+            ret = -1;
+        } else {
+            printf("dmabuf data: %.*s\n", ret, map);
+            ret = 0;
+        }
+
+        munmap(map, sizeof(readbuf));
+        close(dmabuf_fd);
+        close(fd);
+        return ret;
     } else {
         ret = write(fd, userdata, sizeof(userdata));
         if (ret < 0) {
@@ -0,0 +1,417 @@
+/*
+chrdevbase 吞吐与系统调用延迟测试，结果以 CSV 输出到 stdout
+
+./chrdevbase_bench [-d dev] [-m modes] [-t threads] [-s min] [-S max] [-T ms]
+    -d  设备路径，默认 /dev/chrdevbase
+    -m  测试模式，逗号分隔: read,write,mmap,splice,open，默认全部
+    -t  线程数，逗号分隔，默认 1,2,4
+    -s  最小块大小(字节)，默认 1
+    -S  最大块大小(字节)，默认 1048576，块大小按 2 倍递增
+    -T  每组测试时长(ms)，默认 1000
+
+mmap 模式通过 DMABUF_EXPORT_CMD 导出缓冲后 mmap 再 memcpy，驱动不支持时跳过。
+open 模式测试 open+close 的速率，不扫描块大小，size 列为 0。
+块大小不超过 STORE_INFO_CMD 报告的容量，驱动会截断更大的读写。
+read 与 splice 线程开始前先写满一次块大小，否则未写过的会话只读出 kerneldata。
+编译: gcc -O2 -pthread m.c -o chrdevbase_bench
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define DEVICE_PATH "/dev/chrdevbase"
+#define DMABUF_EXPORT_CMD   _IOR(0xEE, 1, int)  // 导出数据缓冲为 dma-buf，返回 fd
+#define STORE_INFO_CMD      _IOR(0xEE, 3, struct store_info)    // 查询容量与驻留页数
+
+#define MAX_SAMPLES     (1 << 16)   // 每线程保留的延迟样本数
+#define MAX_THREADS     64
+
+enum bench_mode {
+    MODE_READ = 0,
+    MODE_WRITE,
+    MODE_MMAP,
+    MODE_SPLICE,
+    MODE_OPEN,
+    MODE_COUNT,
+};
+
+struct store_info {
+    unsigned long long size;            /* 容量，字节 */
+    unsigned long long resident_pages;
+};
+
+static const char *mode_names[MODE_COUNT] = { "read", "write", "mmap", "splice", "open" };
+
+struct bench_thread {
+    pthread_t tid;
+    int mode;
+    size_t size;
+    int err;                    /* 0 成功，否则为 errno */
+    unsigned long long ops;
+    unsigned long long bytes;
+    unsigned int nsamples;
+    unsigned long long *samples;/* 纳秒 */
+};
+
+static const char *dev_path = DEVICE_PATH;
+static unsigned int duration_ms = 1000;
+static volatile int running;
+static pthread_barrier_t start_barrier;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void record(struct bench_thread *t, unsigned long long ns)
+{
+    /* 超出容量后按环形覆盖，保留最近的样本 */
+    t->samples[t->ops % MAX_SAMPLES] = ns;
+    t->ops++;
+    if (t->nsamples < MAX_SAMPLES) {
+        t->nsamples++;
+    }
+}
+
+static void *bench_worker(void *arg)
+{
+    struct bench_thread *t = arg;
+    int fd = -1;
+    int dmabuf_fd = -1;
+    int pipefd[2] = { -1, -1 };
+    int nullfd = -1;
+    char *buf = NULL;
+    char *map = NULL;
+    size_t map_len = 0;
+    unsigned long long t0 = 0;
+    ssize_t ret = 0;
+    loff_t off = 0;
+
+    buf = malloc(t->size ? t->size : 1);
+    if (buf == NULL) {
+        t->err = ENOMEM;
+        goto out_wait;
+    }
+    fd = open(dev_path, O_RDWR);
+    if (fd < 0) {
+        t->err = errno;
+        goto out_wait;
+    }
+    memset(buf, 'a', t->size);
+
+    /* 让会话分配数据缓冲，之后读到的是完整的 size 字节 */
+    if ((t->mode == MODE_READ || t->mode == MODE_SPLICE) &&
+        pwrite(fd, buf, t->size, 0) < 0) {
+        t->err = errno;
+        goto out_wait;
+    }
+
+    if (t->mode == MODE_MMAP) {
+        if (ioctl(fd, DMABUF_EXPORT_CMD, &dmabuf_fd) < 0) {
+            t->err = errno;
+            goto out_wait;
+        }
+        map_len = lseek(dmabuf_fd, 0, SEEK_END);
+        if ((off_t)map_len <= 0) {
+            map_len = t->size;
+        }
+        map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, dmabuf_fd, 0);
+        if (map == MAP_FAILED) {
+            map = NULL;
+            t->err = errno;
+            goto out_wait;
+        }
+    } else if (t->mode == MODE_SPLICE) {
+        nullfd = open("/dev/null", O_WRONLY);
+        if (nullfd < 0 || pipe(pipefd) < 0) {
+            t->err = errno;
+            goto out_wait;
+        }
+        fcntl(pipefd[1], F_SETPIPE_SZ, (int)t->size);
+    }
+
+out_wait:
+    pthread_barrier_wait(&start_barrier);
+    if (t->err) {
+        goto out;
+    }
+
+    while (running) {
+        t0 = now_ns();
+        switch (t->mode) {
+        case MODE_READ:
+            ret = pread(fd, buf, t->size, 0);
+            break;
+        case MODE_WRITE:
+            ret = pwrite(fd, buf, t->size, 0);
+            break;
+        case MODE_MMAP:
+            ret = t->size < map_len ? t->size : map_len;
+            memcpy(buf, map, ret);
+            break;
+        case MODE_OPEN:
+            ret = open(dev_path, O_RDWR);
+            if (ret >= 0) {
+                close(ret);
+                ret = 0;
+            }
+            break;
+        case MODE_SPLICE:
+            off = 0;
+            ret = splice(fd, &off, pipefd[1], NULL, t->size, SPLICE_F_MOVE);
+            if (ret > 0) {
+                splice(pipefd[0], NULL, nullfd, NULL, ret, SPLICE_F_MOVE);
+            }
+            break;
+        default:
+            ret = -1;
+            break;
+        }
+        if (ret < 0) {
+            t->err = errno;
+            break;
+        }
+        record(t, now_ns() - t0);
+        t->bytes += ret;
+    }
+
+out:
+    if (map) {
+        munmap(map, map_len);
+    }
+    if (dmabuf_fd >= 0) {
+        close(dmabuf_fd);
+    }
+    if (pipefd[0] >= 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+    if (nullfd >= 0) {
+        close(nullfd);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free(buf);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double pct_us(unsigned long long *v, unsigned int n, double p)
+{
+    unsigned int idx = 0;
+
+    if (n == 0) {
+        return 0.0;
+    }
+    idx = (unsigned int)(p * (n - 1));
+    return v[idx] / 1000.0;
+}
+
+static int run_one(int mode, int nthreads, size_t size)
+{
+    struct bench_thread t[MAX_THREADS];
+    unsigned long long *all = NULL;
+    unsigned long long ops = 0;
+    unsigned long long bytes = 0;
+    unsigned long long t0 = 0;
+    unsigned int n = 0;
+    double secs = 0.0;
+    int err = 0;
+    int i = 0;
+
+    memset(t, 0, sizeof(t));
+    pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+    running = 1;
+
+    for (i = 0; i < nthreads; i++) {
+        t[i].mode = mode;
+        t[i].size = size;
+        t[i].samples = malloc(MAX_SAMPLES * sizeof(unsigned long long));
+        pthread_create(&t[i].tid, NULL, bench_worker, &t[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    t0 = now_ns();
+    usleep(duration_ms * 1000);
+    running = 0;
+
+    all = malloc((size_t)nthreads * MAX_SAMPLES * sizeof(unsigned long long));
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(t[i].tid, NULL);
+        if (t[i].err && !err) {
+            err = t[i].err;
+        }
+        ops += t[i].ops;
+        bytes += t[i].bytes;
+        memcpy(all + n, t[i].samples, t[i].nsamples * sizeof(unsigned long long));
+        n += t[i].nsamples;
+        free(t[i].samples);
+    }
+    secs = (now_ns() - t0) / 1e9;
+    pthread_barrier_destroy(&start_barrier);
+
+    if (err && ops == 0) {
+        fprintf(stderr, "skip %s threads=%d size=%zu: %s\n",
+                mode_names[mode], nthreads, size, strerror(err));
+        free(all);
+        return -1;
+    }
+
+    qsort(all, n, sizeof(unsigned long long), cmp_u64);
+    printf("%s,%d,%zu,%llu,%.3f,%.0f,%.3f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+           mode_names[mode], nthreads, size, ops, secs,
+           ops / secs, bytes / secs / (1024.0 * 1024.0),
+           pct_us(all, n, 0.50), pct_us(all, n, 0.90),
+           pct_us(all, n, 0.99), pct_us(all, n, 0.999),
+           n ? all[n - 1] / 1000.0 : 0.0);
+    fflush(stdout);
+
+    free(all);
+    return 0;
+}
+
+/* 设备的数据容量，查询失败返回 0 */
+static size_t dev_capacity(void)
+{
+    struct store_info info;
+    int fd = open(dev_path, O_RDWR);
+
+    if (fd < 0) {
+        return 0;
+    }
+    memset(&info, 0, sizeof(info));
+    if (ioctl(fd, STORE_INFO_CMD, &info) < 0) {
+        info.size = 0;
+    }
+    close(fd);
+    return info.size;
+}
+
+static int parse_modes(char *arg, int *modes)
+{
+    char *tok = NULL;
+    int cnt = 0;
+    int i = 0;
+
+    for (tok = strtok(arg, ","); tok && cnt < MODE_COUNT; tok = strtok(NULL, ",")) {
+        for (i = 0; i < MODE_COUNT; i++) {
+            if (strcmp(tok, mode_names[i]) == 0) {
+                break;
+            }
+        }
+        if (i == MODE_COUNT) {
+            printf("unknown mode %s\n", tok);
+            return -1;
+        }
+        modes[cnt++] = i;
+    }
+    return cnt;
+}
+
+static int parse_threads(char *arg, int *threads)
+{
+    char *tok = NULL;
+    int cnt = 0;
+
+    for (tok = strtok(arg, ","); tok && cnt < MAX_THREADS; tok = strtok(NULL, ",")) {
+        threads[cnt] = atoi(tok);
+        if (threads[cnt] < 1 || threads[cnt] > MAX_THREADS) {
+            printf("threads out of range.\n");
+            return -1;
+        }
+        cnt++;
+    }
+    return cnt;
+}
+
+int main(int argc, char *argv[])
+{
+    int modes[MODE_COUNT] = { MODE_READ, MODE_WRITE, MODE_MMAP, MODE_SPLICE, MODE_OPEN };
+    int nmodes = MODE_COUNT;
+    int threads[MAX_THREADS] = { 1, 2, 4 };
+    int nthreads = 3;
+    size_t min_size = 1;
+    size_t max_size = 1024 * 1024;
+    size_t size = 0;
+    size_t cap = 0;
+    int opt = 0;
+    int m = 0;
+    int i = 0;
+
+    while ((opt = getopt(argc, argv, "d:m:t:s:S:T:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dev_path = optarg;
+            break;
+        case 'm':
+            nmodes = parse_modes(optarg, modes);
+            break;
+        case 't':
+            nthreads = parse_threads(optarg, threads);
+            break;
+        case 's':
+            min_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            max_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'T':
+            duration_ms = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            printf("usage: %s [-d dev] [-m modes] [-t threads] [-s min] [-S max] [-T ms]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (nmodes <= 0 || nthreads <= 0 || min_size == 0 || min_size > max_size) {
+        printf("param out of range.\n");
+        return -1;
+    }
+    cap = dev_capacity();
+    if (cap && max_size > cap) {
+        fprintf(stderr, "max size clamped to device capacity %zu\n", cap);
+        max_size = cap;
+        if (min_size > max_size) {
+            min_size = max_size;
+        }
+    }
+
+    printf("mode,threads,size,ops,seconds,ops_per_s,MB_per_s,p50_us,p90_us,p99_us,p999_us,max_us\n");
+    for (m = 0; m < nmodes; m++) {
+        for (i = 0; i < nthreads; i++) {
+            if (modes[m] == MODE_OPEN) {
+                run_one(modes[m], threads[i], 0);
+                continue;
+            }
+            for (size = min_size; size <= max_size; size *= 2) {
+                if (run_one(modes[m], threads[i], size) < 0) {
+                    break;  /* 该模式不可用，不再扫描更大的块 */
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -4,6 +4,22 @@
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/io.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/capability.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include <linux/device.h>
+#include <linux/pm_runtime.h>
+
+#include "../common/fop_stats.h"
+#include "../common/led_pwm.h"
+#include "../common/err_stats.h"
 
 #define DRIVER_MAJOR 200            // 主设备号
 #define DRIVER_NAME "led"    // 名字
@@ -11,6 +27,55 @@
 #define LEDOFF 0
 #define LEDON 1
 
+#define LED_PIN_MASK (1 << 3)   // 本驱动占用的 GPIO1 引脚
+#define CCGR1_GPIO1_CG (0b11 << 26)    // CCM_CCGR1 中 GPIO1 的时钟门控位
+
+/* 流式输出，一次 write 提交大量采样，由 hrtimer 按时间播放 */
+#define LED_STREAM_CMD  _IOW(0xEF, 1, struct led_stream_cfg)    // 配置流式输出
+
+#define STREAM_OFF      0   /* 关闭，write 为原来的单字节 LEDON/LEDOFF */
+#define STREAM_MASK     1   /* 每个采样一个 u32 GPIO1 位图，按 rate_hz 播放 */
+#define STREAM_TIMED    2   /* 每个采样 {value, hold_us}，输出 value 后保持 hold_us */
+#define STREAM_BURST    3   /* 每个采样一个 u32 位图，write 内立即连续输出 */
+#define STREAM_BURST_STRICT 4   /* 同 STREAM_BURST，但每次写都带屏障，仅用于对比 */
+
+#define BURST_CHUNK     64  /* 突发输出每次持锁处理的采样数 */
+
+#define STREAM_FIFO_SIZE 4096   /* u32 个数，必须是 2 的幂 */
+/*
+ * STREAM_MASK 的最高采样率。每个采样是一次 hrtimer 硬中断回调(进出中断、取 FIFO、
+ * 写 DR、唤醒写者、重设定时器)，Cortex-A7 上估计每次数微秒，20 kHz 时已占一成以上 CPU，
+ * 再高会先饿死其他任务，等不到回调落后时的重新计时起作用
+ */
+#define STREAM_MAX_HZ   20000
+#define STREAM_MIN_NS   (NSEC_PER_SEC / STREAM_MAX_HZ)  /* 每个采样至少保持的时间，hold_us 为 0 也按此计 */
+
+struct led_stream_cfg {
+    __u32 format;
+    __u32 rate_hz;      /* 仅 STREAM_MASK 使用 */
+};
+
+struct led_sample_timed {
+    __u32 value;        /* GPIO1_DR 位图，只有 LED_PIN_MASK 内的位生效 */
+    __u32 hold_us;
+};
+
+/* 读取 MMIO 访问计数，用于统计每次操作的寄存器访问次数 */
+#define LED_MMIO_STATS_CMD  _IOR(0xEF, 3, struct led_mmio_stats)
+
+struct led_mmio_stats {
+    __u64 reads;
+    __u64 writes;
+};
+
+/* 屏蔽的置位/清零窗口，只作用于授权引脚，一次写寄存器完成 */
+#define LED_GPIO_SETCLR_CMD _IOW(0xEF, 2, struct led_gpio_setclr)
+
+struct led_gpio_setclr {
+    __u32 set;
+    __u32 clr;
+};
+
 /* 寄存器物理地址 */
 #define CCM_CCGR1_BASE (0x020C406C)
 #define SW_MUX_GPIO1_IO03_BASE (0x020E0068)
@@ -26,22 +91,703 @@ static void __iomem *SW_PAD_GPIO1_IO03;
 static void __iomem *GPIO1_GDIR;
 static void __iomem *GPIO1_DR;
 
+/*
+ * 模拟寄存器后端，sim=1 时寄存器落在 vmalloc 的内存里，驱动可以在
+ * x86 或 QEMU 上加载测试。三页分别对应 CCM、IOMUXC 与 GPIO1 所在的页。
+ */
+#define SIM_PAGE_CCM    0
+#define SIM_PAGE_IOMUXC 1
+#define SIM_PAGE_GPIO1  2
+#define SIM_PAGES       3
+#define SIM_REG(page, phys) ((void __iomem *)(sim_regs + (page) * PAGE_SIZE + ((phys) & ~PAGE_MASK)))
+
+static bool sim;
+module_param(sim, bool, 0444);
+MODULE_PARM_DESC(sim, "use a vmalloc'd simulated register file instead of the SoC registers");
+
+static char *sim_regs;
+
+/* MMIO 访问计数，每 CPU 一份，读取时求和 */
+static DEFINE_PER_CPU(unsigned long, mmio_reads);
+static DEFINE_PER_CPU(unsigned long, mmio_writes);
+
+/* 所有寄存器访问都经过这里，计数并可通过 dynamic debug 跟踪 */
+static inline u32 led_readl(const void __iomem *addr)
+{
+    u32 val = readl(addr);
+
+    this_cpu_inc(mmio_reads);
+    pr_debug("mmio r %p = %#x\n", addr, val);
+    return val;
+}
+
+static inline void led_writel(u32 val, void __iomem *addr)
+{
+    writel(val, addr);
+    this_cpu_inc(mmio_writes);
+    pr_debug("mmio w %p = %#x\n", addr, val);
+}
+
+/* 不带屏障的写，只在突发路径中使用，整段写完后由调用者补一次 wmb() */
+static inline void led_writel_relaxed(u32 val, void __iomem *addr)
+{
+    writel_relaxed(val, addr);
+    this_cpu_inc(mmio_writes);
+    pr_debug("mmio w %p = %#x (relaxed)\n", addr, val);
+}
+
+static void led_mmio_stats(struct led_mmio_stats *st)
+{
+    int cpu = 0;
+
+    st->reads = 0;
+    st->writes = 0;
+    for_each_possible_cpu(cpu) {
+        st->reads += per_cpu(mmio_reads, cpu);
+        st->writes += per_cpu(mmio_writes, cpu);
+    }
+}
+
+/* GPIO1_DR 影子寄存器，翻转时只写不读，gpio1_lock 保护影子与寄存器写入 */
+static DEFINE_SPINLOCK(gpio1_lock);
+static u32 gpio1_dr_shadow;
+static atomic_t gpio1_raw_maps;     /* 寄存器页的用户空间映射数 */
+
+/* 流式输出状态，stream_running 与 GPIO1 一起由 gpio1_lock 保护 */
+static DECLARE_KFIFO(stream_fifo, u32, STREAM_FIFO_SIZE);
+static DECLARE_WAIT_QUEUE_HEAD(stream_wq);
+static DEFINE_MUTEX(stream_mutex);  /* 串行化多个写者与配置 */
+static struct hrtimer stream_timer;
+static u32 stream_format;
+static u64 stream_period_ns;
+static bool stream_running;
+
+static int autosuspend_ms = 2000;
+module_param(autosuspend_ms, int, 0444);
+MODULE_PARM_DESC(autosuspend_ms, "idle time in ms before the GPIO1 clock is gated, negative never gates");
+
+static struct class *led_class;
+static struct device *led_device;
+
+static struct err_stats led_errors;
+
+/* 运行时 PM 统计与系统睡眠时保存的寄存器 */
+static struct {
+    spinlock_t lock;
+    unsigned long suspends;
+    unsigned long resumes;
+    unsigned long wakeups;  /* led_pm_get 中需要唤醒的次数 */
+    u64 wake_ns;
+    u64 wake_max_ns;
+    u32 mux;                /* 系统睡眠时保存的寄存器 */
+    u32 pad;
+    u32 gdir;
+} led_pm = {
+    .lock = __SPIN_LOCK_UNLOCKED(led_pm.lock),
+};
+
+static struct led_pwm pwm;
+
+static unsigned int bench_toggles;  // 非 0 时加载时测量 RMW 与影子寄存器两种翻转方式
+module_param(bench_toggles, uint, 0444);
+MODULE_PARM_DESC(bench_toggles, "toggle count for the load-time led_switch microbenchmark");
+
+/* 从硬件重新同步影子，其他路径修改过 GPIO1 后调用 */
+static void gpio1_dr_sync(void)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&gpio1_lock, flags);
+    gpio1_dr_shadow = led_readl(GPIO1_DR);
+    spin_unlock_irqrestore(&gpio1_lock, flags);
+}
+
+/* 寄存器页映射到用户空间期间影子可能过期，先回读，调用者持有 gpio1_lock */
+static inline void gpio1_dr_refresh(void)
+{
+    if (atomic_read(&gpio1_raw_maps)) {
+        gpio1_dr_shadow = led_readl(GPIO1_DR);
+    }
+}
+
 void led_switch(u8 sta)
 {
-    u32 val = 0;
+    unsigned long flags;
+
+    spin_lock_irqsave(&gpio1_lock, flags);
+    gpio1_dr_refresh();
     if (sta == LEDON) {
-        val = readl(GPIO1_DR);
-        val &= ~(1 << 3);   // bit3置0
-        writel(val, GPIO1_DR);
+        gpio1_dr_shadow &= ~(1 << 3);   // bit3置0
     } else if (sta == LEDOFF) {
-        val = readl(GPIO1_DR);
-        val|= (1 << 3);     // bit3置1
-        writel(val, GPIO1_DR);
+        gpio1_dr_shadow |= (1 << 3);    // bit3置1
+    }
+    led_writel(gpio1_dr_shadow, GPIO1_DR);
+    spin_unlock_irqrestore(&gpio1_lock, flags);
+}
+
+/* 只修改本驱动占用的引脚，调用者持有 gpio1_lock */
+static void gpio1_write_masked(u32 val)
+{
+    gpio1_dr_refresh();
+    gpio1_dr_shadow = (gpio1_dr_shadow & ~LED_PIN_MASK) | (val & LED_PIN_MASK);
+    led_writel(gpio1_dr_shadow, GPIO1_DR);
+}
+
+/* 原先的读-改-写翻转，仅用于对比测试 */
+static void led_switch_rmw(u8 sta)
+{
+    unsigned long flags;
+    u32 val = 0;
+
+    spin_lock_irqsave(&gpio1_lock, flags);
+    val = led_readl(GPIO1_DR);
+    if (sta == LEDON) {
+        val &= ~(1 << 3);
+    } else {
+        val |= (1 << 3);
+    }
+    led_writel(val, GPIO1_DR);
+    gpio1_dr_shadow = val;
+    spin_unlock_irqrestore(&gpio1_lock, flags);
+}
+
+static void led_bench(unsigned int n)
+{
+    ktime_t t0;
+    s64 rmw_ns = 0;
+    s64 shadow_ns = 0;
+    unsigned int i = 0;
+
+    t0 = ktime_get();
+    for (i = 0; i < n; i++) {
+        led_switch_rmw(i & 1);
+    }
+    rmw_ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+    t0 = ktime_get();
+    for (i = 0; i < n; i++) {
+        led_switch(i & 1);
+    }
+    shadow_ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+
+    printk("led bench %u toggles: rmw %lld ns (%llu/s), shadow %lld ns (%llu/s)\n", n,
+           rmw_ns, div64_u64((u64)n * NSEC_PER_SEC, max_t(s64, rmw_ns, 1)),
+           shadow_ns, div64_u64((u64)n * NSEC_PER_SEC, max_t(s64, shadow_ns, 1)));
+}
+
+/* GPIO1 时钟门控，运行时 PM 在空闲 autosuspend_ms 后关闭时钟 */
+static void gpio1_clk_set(bool on)
+{
+    u32 val = led_readl(CCM_CCGR1);    /* CCGR1 与其他外设共用，读-改-写 */
+
+    if (on) {
+        val |= CCGR1_GPIO1_CG;
+    } else {
+        val &= ~CCGR1_GPIO1_CG;
+    }
+    led_writel(val, CCM_CCGR1);
+}
+
+/* 访问寄存器前调用，时钟已关闭时同步打开并记录唤醒耗时 */
+static int led_pm_get(void)
+{
+    bool cold = pm_runtime_suspended(led_device);
+    ktime_t t0 = ktime_get();
+    unsigned long flags;
+    u64 ns = 0;
+    int ret = 0;
+
+    ret = pm_runtime_get_sync(led_device);
+    if (ret < 0) {
+        pm_runtime_put_noidle(led_device);
+        return ret;
+    }
+
+    if (cold) {
+        ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+        spin_lock_irqsave(&led_pm.lock, flags);
+        led_pm.wakeups++;
+        led_pm.wake_ns += ns;
+        led_pm.wake_max_ns = max(led_pm.wake_max_ns, ns);
+        spin_unlock_irqrestore(&led_pm.lock, flags);
+    }
+    return 0;
+}
+
+static void led_pm_put(void)
+{
+    pm_runtime_mark_last_busy(led_device);
+    pm_runtime_put_autosuspend(led_device);
+}
+
+static int __maybe_unused led_runtime_suspend(struct device *dev)
+{
+    gpio1_clk_set(false);
+    led_pm.suspends++;
+    return 0;
+}
+
+static int __maybe_unused led_runtime_resume(struct device *dev)
+{
+    gpio1_clk_set(true);
+    led_pm.resumes++;
+    return 0;
+}
+
+/* 系统睡眠时 IOMUXC 与 GPIO 可能掉电，保存并恢复复用、电气属性与方向 */
+static int __maybe_unused led_suspend(struct device *dev)
+{
+    gpio1_clk_set(true);
+    led_pm.mux = led_readl(SW_MUX_GPIO1_IO03);
+    led_pm.pad = led_readl(SW_PAD_GPIO1_IO03);
+    led_pm.gdir = led_readl(GPIO1_GDIR);
+    if (pm_runtime_status_suspended(dev)) {
+        gpio1_clk_set(false);
+    }
+    return 0;
+}
+
+static int __maybe_unused led_resume(struct device *dev)
+{
+    unsigned long flags;
+
+    gpio1_clk_set(true);
+    led_writel(led_pm.mux, SW_MUX_GPIO1_IO03);
+    led_writel(led_pm.pad, SW_PAD_GPIO1_IO03);
+    led_writel(led_pm.gdir, GPIO1_GDIR);
+    spin_lock_irqsave(&gpio1_lock, flags);
+    led_writel(gpio1_dr_shadow, GPIO1_DR);
+    spin_unlock_irqrestore(&gpio1_lock, flags);
+    if (pm_runtime_status_suspended(dev)) {
+        gpio1_clk_set(false);
+    }
+    return 0;
+}
+
+static const struct dev_pm_ops led_pm_ops = {
+    SET_SYSTEM_SLEEP_PM_OPS(led_suspend, led_resume)
+    SET_RUNTIME_PM_OPS(led_runtime_suspend, led_runtime_resume, NULL)
+};
+
+static ssize_t pm_stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    unsigned long flags;
+    ssize_t len = 0;
+
+    spin_lock_irqsave(&led_pm.lock, flags);
+    len = sprintf(buf, "suspends %lu\nresumes %lu\nwakeups %lu\nwake_avg_ns %llu\nwake_max_ns %llu\n",
+                  led_pm.suspends, led_pm.resumes, led_pm.wakeups,
+                  led_pm.wakeups ? div64_u64(led_pm.wake_ns, led_pm.wakeups) : 0,
+                  led_pm.wake_max_ns);
+    spin_unlock_irqrestore(&led_pm.lock, flags);
+
+    return len;
+}
+static DEVICE_ATTR_RO(pm_stats);
+
+static struct attribute *led_attrs[] = {
+    &dev_attr_pm_stats.attr,
+    NULL,
+};
+
+static const struct attribute_group led_group = {
+    .attrs = led_attrs,
+};
+
+static const struct attribute_group *led_groups[] = {
+    &led_group,
+    &err_stats_group,
+    NULL,
+};
+
+/* 初始化完成时时钟是开着的，空闲 autosuspend_ms 后关闭，负值表示不关闭 */
+static void led_pm_enable(struct device *dev)
+{
+    pm_runtime_set_active(dev);
+    pm_runtime_set_autosuspend_delay(dev, autosuspend_ms);
+    pm_runtime_use_autosuspend(dev);
+    pm_runtime_enable(dev);
+    pm_runtime_mark_last_busy(dev);
+    pm_request_autosuspend(dev);
+}
+
+/* 卸载时恢复原来的状态：时钟保持打开 */
+static void led_pm_disable(struct device *dev)
+{
+    pm_runtime_disable(dev);
+    pm_runtime_dont_use_autosuspend(dev);
+    if (pm_runtime_status_suspended(dev)) {
+        gpio1_clk_set(true);
+    }
+    pm_runtime_set_suspended(dev);
+}
+
+static enum hrtimer_restart stream_timer_func(struct hrtimer *timer)
+{
+    struct led_sample_timed sample;
+    ktime_t now = hrtimer_cb_get_time(timer);
+    u64 hold_ns = 0;
+
+    spin_lock(&gpio1_lock);
+    if (stream_format == STREAM_MASK) {
+        if (!kfifo_get(&stream_fifo, &sample.value)) {
+            goto stop;
+        }
+        hold_ns = stream_period_ns;
+    } else {
+        if (kfifo_out(&stream_fifo, (u32 *)&sample, 2) != 2) {
+            goto stop;
+        }
+        hold_ns = (u64)sample.hold_us * NSEC_PER_USEC;
+    }
+    gpio1_write_masked(sample.value);
+    spin_unlock(&gpio1_lock);
+
+    wake_up_interruptible(&stream_wq);
+    /* 按绝对时间推进，不累积回调延迟；已落后时从当前时刻重新计时，不在中断里连续补播 */
+    hold_ns = max_t(u64, hold_ns, STREAM_MIN_NS);
+    hrtimer_add_expires_ns(timer, hold_ns);
+    if (ktime_before(hrtimer_get_expires(timer), now)) {
+        hrtimer_set_expires(timer, ktime_add_ns(now, hold_ns));
+    }
+    return HRTIMER_RESTART;
+
+stop:
+    stream_running = false;
+    spin_unlock(&gpio1_lock);
+    wake_up_interruptible(&stream_wq);
+    return HRTIMER_NORESTART;
+}
+
+static void stream_stop(void)
+{
+    unsigned long flags;
+
+    hrtimer_cancel(&stream_timer);
+    spin_lock_irqsave(&gpio1_lock, flags);
+    stream_running = false;
+    kfifo_reset(&stream_fifo);
+    spin_unlock_irqrestore(&gpio1_lock, flags);
+}
+
+/*
+ * 突发输出一组位图，调用者持有 gpio1_lock。
+ * ARM 上每次 writel 都带一次 wmb，而同一设备的 relaxed 写之间本身保序，
+ * 所以整段用 writel_relaxed，最后只做一次 wmb()，让这些写排在之后的写(包括解锁)
+ * 之前。wmb() 只保证顺序，不等写入到达设备，这里也不需要。
+ * strict 为真时逐次使用 writel，用于对比两种路径。
+ */
+static void gpio1_write_burst(const u32 *vals, unsigned int n, bool strict)
+{
+    unsigned int i = 0;
+
+    gpio1_dr_refresh();
+    for (i = 0; i < n; i++) {
+        gpio1_dr_shadow = (gpio1_dr_shadow & ~LED_PIN_MASK) | (vals[i] & LED_PIN_MASK);
+        if (strict) {
+            led_writel(gpio1_dr_shadow, GPIO1_DR);
+        } else {
+            led_writel_relaxed(gpio1_dr_shadow, GPIO1_DR);
+        }
+    }
+    if (!strict) {
+        wmb();
+    }
+}
+
+/* STREAM_BURST 下的 write，分块拷贝后持锁连续输出，不经过 FIFO 与定时器 */
+static ssize_t burst_write(const char __user *buf, size_t cnt)
+{
+    u32 vals[BURST_CHUNK];
+    size_t done = 0;
+    size_t len = 0;
+    unsigned long flags;
+    bool strict = false;
+
+    cnt -= cnt % sizeof(u32);
+    if (cnt == 0) {
+        return -EINVAL;
+    }
+    if (mutex_lock_interruptible(&stream_mutex)) {
+        return -ERESTARTSYS;
+    }
+
+    strict = (stream_format == STREAM_BURST_STRICT);
+    while (done < cnt) {
+        len = min_t(size_t, cnt - done, sizeof(vals));
+        if (copy_from_user(vals, buf + done, len)) {
+            break;
+        }
+        spin_lock_irqsave(&gpio1_lock, flags);
+        gpio1_write_burst(vals, len / sizeof(u32), strict);
+        spin_unlock_irqrestore(&gpio1_lock, flags);
+        done += len;
+    }
+    mutex_unlock(&stream_mutex);
+
+    return done ? done : -EFAULT;
+}
+
+static void led_pwm_output(struct led_pwm *pwm, bool on)
+{
+    led_switch(on ? LEDON : LEDOFF);
+}
+
+static int stream_config(struct led_stream_cfg *cfg)
+{
+    int ret = 0;
+
+    if (cfg->format > STREAM_BURST_STRICT) {
+        return -EINVAL;
+    }
+    if (cfg->format == STREAM_MASK && (cfg->rate_hz == 0 || cfg->rate_hz > STREAM_MAX_HZ)) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&stream_mutex);
+    if (cfg->format != STREAM_OFF && pwm.enabled) {
+        mutex_unlock(&stream_mutex);
+        return -EBUSY;
+    }
+    /* 流式与突发模式下定时器和写路径随时访问寄存器，期间一直持有 PM 引用 */
+    if (cfg->format != STREAM_OFF && stream_format == STREAM_OFF) {
+        ret = led_pm_get();
+        if (ret) {
+            mutex_unlock(&stream_mutex);
+            return ret;
+        }
+    }
+    stream_stop();
+    if (cfg->format == STREAM_OFF && stream_format != STREAM_OFF) {
+        led_pm_put();
+    }
+    stream_format = cfg->format;
+    stream_period_ns = cfg->rate_hz ? div_u64(NSEC_PER_SEC, cfg->rate_hz) : 0;
+    mutex_unlock(&stream_mutex);
+
+    return 0;
+}
+
+/* PWM 与流式输出互斥，由 stream_mutex 串行化，PWM 开启期间持有 PM 引用 */
+static int led_pwm_config(struct led_pwm_cfg *cfg)
+{
+    bool was_enabled = false;
+    int ret = 0;
+
+    mutex_lock(&stream_mutex);
+    was_enabled = pwm.enabled;
+    if (cfg->freq_hz && stream_format != STREAM_OFF) {
+        ret = -EBUSY;
+        goto out;
+    }
+    if (cfg->freq_hz && !was_enabled) {
+        ret = led_pm_get();
+        if (ret) {
+            goto out;
+        }
+    }
+
+    ret = pwm_config(&pwm, cfg);
+    if (ret < 0) {
+        if (cfg->freq_hz && !was_enabled) {
+            led_pm_put();
+        }
+    } else if (!cfg->freq_hz && was_enabled) {
+        led_pm_put();
+    }
+
+out:
+    mutex_unlock(&stream_mutex);
+    return ret;
+}
+
+/* 写入采样，FIFO 满时阻塞，O_NONBLOCK 时返回已写入的部分或 -EAGAIN */
+static ssize_t stream_write(struct file *filp, const char __user *buf, size_t cnt)
+{
+    size_t sample_size = 0;
+    size_t done = 0;
+    size_t len = 0;
+    unsigned int copied = 0;
+    unsigned long flags;
+    int ret = 0;
+
+    if (mutex_lock_interruptible(&stream_mutex)) {
+        return -ERESTARTSYS;
+    }
+
+    sample_size = (stream_format == STREAM_MASK) ? sizeof(u32) : sizeof(struct led_sample_timed);
+    cnt -= cnt % sample_size;
+    if (stream_format == STREAM_OFF || cnt == 0) {
+        ret = -EINVAL;
+    }
+
+    while (ret == 0 && done < cnt) {
+        if (kfifo_avail(&stream_fifo) * sizeof(u32) < sample_size) {
+            if (filp->f_flags & O_NONBLOCK) {
+                ret = -EAGAIN;
+                break;
+            }
+            ret = wait_event_interruptible(stream_wq,
+                    kfifo_avail(&stream_fifo) * sizeof(u32) >= sample_size);
+            if (ret) {
+                break;
+            }
+        }
+
+        len = min_t(size_t, cnt - done, kfifo_avail(&stream_fifo) * sizeof(u32));
+        len -= len % sample_size;
+        ret = kfifo_from_user(&stream_fifo, buf + done, len, &copied);
+        if (ret) {
+            break;
+        }
+        done += copied;
+
+        /* 定时器已停止时重新启动，判断与回调中的停止在同一把锁下 */
+        spin_lock_irqsave(&gpio1_lock, flags);
+        if (!stream_running) {
+            stream_running = true;
+            hrtimer_start(&stream_timer, ktime_get(), HRTIMER_MODE_ABS);
+        }
+        spin_unlock_irqrestore(&gpio1_lock, flags);
+    }
+    mutex_unlock(&stream_mutex);
+
+    return done ? done : ret;
+}
+
+static void gpio1_setclr(u32 set, u32 clr)
+{
+    unsigned long flags;
+
+    set &= LED_PIN_MASK;
+    clr &= LED_PIN_MASK;
+
+    spin_lock_irqsave(&gpio1_lock, flags);
+    gpio1_dr_refresh();
+    gpio1_dr_shadow = (gpio1_dr_shadow & ~clr) | set;
+    led_writel(gpio1_dr_shadow, GPIO1_DR);
+    spin_unlock_irqrestore(&gpio1_lock, flags);
+}
+
+static void led_vma_open(struct vm_area_struct *vma)
+{
+    /* 映射期间用户空间随时访问寄存器，时钟必须一直开着 */
+    pm_runtime_get_sync(led_device);
+    atomic_inc(&gpio1_raw_maps);
+}
+
+static void led_vma_close(struct vm_area_struct *vma)
+{
+    /* 最后一个映射解除后影子重新以硬件为准 */
+    if (atomic_dec_and_test(&gpio1_raw_maps)) {
+        gpio1_dr_sync();
+    }
+    led_pm_put();
+}
+
+static const struct vm_operations_struct led_vm_ops = {
+    .open = led_vma_open,
+    .close = led_vma_close,
+};
+
+/*
+ * 把 GPIO1 寄存器页映射到用户空间，翻转不再需要系统调用。
+ * 硬件无法按引脚限制页内访问，所以只有驱动独占整个 bank 或调用者有
+ * CAP_SYS_RAWIO 时才允许，其他情况使用 LED_GPIO_SETCLR_CMD。
+ */
+static int led_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE) {
+        return -EINVAL;
+    }
+    if (LED_PIN_MASK != 0xFFFFFFFF && !capable(CAP_SYS_RAWIO)) {
+        return -EPERM;
+    }
+
+    if (sim) {
+        if (remap_vmalloc_range(vma, sim_regs, SIM_PAGE_GPIO1)) {
+            return -EAGAIN;
+        }
+    } else {
+        vma->vm_flags |= VM_IO | VM_DONTEXPAND | VM_DONTDUMP;
+        vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+        if (io_remap_pfn_range(vma, vma->vm_start, GPIO1_DR_BASE >> PAGE_SHIFT,
+                               PAGE_SIZE, vma->vm_page_prot)) {
+            return -EAGAIN;
+        }
+    }
+
+    vma->vm_ops = &led_vm_ops;
+    led_vma_open(vma);
+    return 0;
+}
+
+static long led_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct led_stream_cfg cfg;
+    struct led_gpio_setclr sc;
+    struct led_mmio_stats st;
+    struct led_pwm_cfg pcfg;
+    struct led_fade fade;
+    struct led_pwm_stats pst;
+    int ret = 0;
+
+    switch (cmd)
+    {
+    case LED_STREAM_CMD:
+        if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg))) {
+            return -EFAULT;
+        }
+        return stream_config(&cfg);
+    case LED_GPIO_SETCLR_CMD:
+        if (copy_from_user(&sc, (void __user *)arg, sizeof(sc))) {
+            return -EFAULT;
+        }
+        ret = led_pm_get();
+        if (ret) {
+            return ret;
+        }
+        gpio1_setclr(sc.set, sc.clr);
+        led_pm_put();
+        return 0;
+    case LED_PWM_CMD:
+        if (copy_from_user(&pcfg, (void __user *)arg, sizeof(pcfg))) {
+            return -EFAULT;
+        }
+        return led_pwm_config(&pcfg);
+    case LED_FADE_CMD:
+        if (copy_from_user(&fade, (void __user *)arg, sizeof(fade))) {
+            return -EFAULT;
+        }
+        return pwm_fade(&pwm, &fade);
+    case LED_PWM_STATS_CMD:
+        pwm_get_stats(&pwm, &pst);
+        if (copy_to_user((void __user *)arg, &pst, sizeof(pst))) {
+            return -EFAULT;
+        }
+        return 0;
+    case LED_MMIO_STATS_CMD:
+        led_mmio_stats(&st);
+        if (copy_to_user((void __user *)arg, &st, sizeof(st))) {
+            return -EFAULT;
+        }
+        return 0;
+    default:
+        return -ENOTTY;
     }
 }
 
 static int led_open(struct inode *inode, struct file *filp)
 {
+    int ret = 0;
+
+    /* 打开时同步一次，翻转路径不再读寄存器 */
+    ret = led_pm_get();
+    if (ret) {
+        return ret;
+    }
+    gpio1_dr_sync();
+    led_pm_put();
     return 0;
 }
 
@@ -57,17 +803,36 @@ static ssize_t led_write(struct file *filp, const char __user *buf,
     int ret = 0;
     uint8_t data[1];
 
-    ret = __copy_from_user(data, buf, cnt);
-    if (ret < 0) {
-        printk("kernel write failed.\n");
+    if (stream_format == STREAM_BURST || stream_format == STREAM_BURST_STRICT) {
+        return burst_write(buf, cnt);
+    }
+    if (stream_format != STREAM_OFF) {
+        return stream_write(filp, buf, cnt);
+    }
+
+    ret = copy_from_user(data, buf, sizeof(data));
+    if (ret != 0) {
+        atomic_long_inc(&led_errors.fault);
+        dev_dbg_ratelimited(led_device, "kernel write failed.\n");
         return -1;
     }
 
     if ((data[0] != LEDON) && (data[0] != LEDOFF)) {
-        printk("param out of range.\n");
+        atomic_long_inc(&led_errors.inval);
+        dev_dbg_ratelimited(led_device, "param out of range.\n");
         return -1;
     }
+
+    if (pwm.enabled) {
+        return pwm_switch(&pwm, data[0] == LEDON);
+    }
+
+    ret = led_pm_get();
+    if (ret) {
+        return ret;
+    }
     led_switch(data[0]);
+    led_pm_put();
 
     return 0;
 }
@@ -82,62 +847,137 @@ static struct file_operations driver_fops = {
     .open = led_open, 
     .read = led_read, 
     .write = led_write, 
+    .unlocked_ioctl = led_ioctl,
+    .mmap = led_mmap,
     .release = led_release, 
 };
 
+static void led_unmap(void)
+{
+    if (sim) {
+        vfree(sim_regs);
+    } else {
+        iounmap(CCM_CCGR1);
+        iounmap(SW_MUX_GPIO1_IO03);
+        iounmap(SW_PAD_GPIO1_IO03);
+        iounmap(GPIO1_GDIR);
+        iounmap(GPIO1_DR);
+    }
+}
+
 static int __init led_init(void)
 {
     int ret = 0;
     uint32_t val = 0;
 
     /* 初始化 LED */
-    /* 1. 寄存器地址映射 */
-    CCM_CCGR1 = ioremap(CCM_CCGR1_BASE, 4);
-    SW_MUX_GPIO1_IO03 = ioremap(SW_MUX_GPIO1_IO03_BASE, 4);
-    SW_PAD_GPIO1_IO03 = ioremap(SW_PAD_GPIO1_IO03_BASE, 4);
-    GPIO1_GDIR = ioremap(GPIO1_GDIR_BASE, 4);
-    GPIO1_DR = ioremap(GPIO1_DR_BASE, 4);
-    
+    /* 1. 寄存器地址映射，模拟时指向 vmalloc 的寄存器文件 */
+    if (sim) {
+        sim_regs = vmalloc_user(SIM_PAGES * PAGE_SIZE);
+        if (!sim_regs) {
+            return -ENOMEM;
+        }
+        CCM_CCGR1 = SIM_REG(SIM_PAGE_CCM, CCM_CCGR1_BASE);
+        SW_MUX_GPIO1_IO03 = SIM_REG(SIM_PAGE_IOMUXC, SW_MUX_GPIO1_IO03_BASE);
+        SW_PAD_GPIO1_IO03 = SIM_REG(SIM_PAGE_IOMUXC, SW_PAD_GPIO1_IO03_BASE);
+        GPIO1_GDIR = SIM_REG(SIM_PAGE_GPIO1, GPIO1_GDIR_BASE);
+        GPIO1_DR = SIM_REG(SIM_PAGE_GPIO1, GPIO1_DR_BASE);
+        printk("led: using simulated registers\n");
+    } else {
+        CCM_CCGR1 = ioremap(CCM_CCGR1_BASE, 4);
+        SW_MUX_GPIO1_IO03 = ioremap(SW_MUX_GPIO1_IO03_BASE, 4);
+        SW_PAD_GPIO1_IO03 = ioremap(SW_PAD_GPIO1_IO03_BASE, 4);
+        GPIO1_GDIR = ioremap(GPIO1_GDIR_BASE, 4);
+        GPIO1_DR = ioremap(GPIO1_DR_BASE, 4);
+    }
+
     /* 2. 使能GPIO1时钟 */
-    val = readl(CCM_CCGR1);
-    val |= (0b11 << 26);    // bit 26 27 set 1
-    writel(val, CCM_CCGR1);
+    val = led_readl(CCM_CCGR1);
+    val |= CCGR1_GPIO1_CG;  // bit 26 27 set 1
+    led_writel(val, CCM_CCGR1);
 
     /* 3. 设置 GPIO1_IO03 复用功能 */
-    writel(0b101, SW_MUX_GPIO1_IO03);
+    led_writel(0b101, SW_MUX_GPIO1_IO03);
 
     /* 4. 设置IO属性 */
-    writel(0x10B0, SW_PAD_GPIO1_IO03);
+    led_writel(0x10B0, SW_PAD_GPIO1_IO03);
 
     /* 5. 设置GPIO1_IO03为输出 */
-    val = readl(GPIO1_GDIR);
+    val = led_readl(GPIO1_GDIR);
     val |= (1 << 3);
-    writel(val, GPIO1_GDIR);
+    led_writel(val, GPIO1_GDIR);
+
+    /* 流式输出 */
+    INIT_KFIFO(stream_fifo);
+    hrtimer_init(&stream_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    stream_timer.function = stream_timer_func;
+    pwm_init(&pwm, led_pwm_output);
 
     /* 默认熄灭灯 */
+    gpio1_dr_sync();
     led_switch(LEDOFF);
+    if (bench_toggles) {
+        led_bench(bench_toggles);
+        led_switch(LEDOFF);
+    }
+
+    /* 运行时 PM 需要一个 struct device，回调挂在类上 */
+    led_class = class_create(THIS_MODULE, DRIVER_NAME);
+    if (IS_ERR(led_class)) {
+        ret = PTR_ERR(led_class);
+        printk("class_create failed.\n");
+        goto fail_class;
+    }
+    led_class->pm = &led_pm_ops;
+
+    led_device = device_create_with_groups(led_class, NULL, MKDEV(DRIVER_MAJOR, 0), &led_errors,
+                                           led_groups, DRIVER_NAME);
+    if (IS_ERR(led_device)) {
+        ret = PTR_ERR(led_device);
+        printk("device_create failed.\n");
+        goto fail_device;
+    }
+    led_pm_enable(led_device);
 
-    /* 注册字符设备驱动 */
-    ret = register_chrdev(DRIVER_MAJOR, DRIVER_NAME, &driver_fops);
+    /*
+     * 注册字符设备驱动。主设备号固定，/dev/led 可能早已存在，
+     * 注册后立即可以 open，映射、led_device 与运行时 PM 必须先准备好
+     */
+    ret = register_chrdev(DRIVER_MAJOR, DRIVER_NAME, fop_stats_init(DRIVER_NAME, &driver_fops));
     if (ret < 0) {
         printk("led_init failed.\n");
-        return -1;
+        goto fail_chrdev;
     }
 
     return 0;
+
+fail_chrdev:
+    fop_stats_exit();
+    led_pm_disable(led_device);
+    device_destroy(led_class, MKDEV(DRIVER_MAJOR, 0));
+fail_device:
+    class_destroy(led_class);
+fail_class:
+    led_unmap();
+    return -1;
 }
 
+/* 与初始化相反的顺序，先注销字符设备，之后不会再有新的 open */
 static void __exit led_exit(void)
 {
-    /* 取消映射 */
-    iounmap(CCM_CCGR1);
-    iounmap(SW_MUX_GPIO1_IO03);
-    iounmap(SW_PAD_GPIO1_IO03);
-    iounmap(GPIO1_GDIR);
-    iounmap(GPIO1_DR);
-
     /* 注销字符设备驱动 */
     unregister_chrdev(DRIVER_MAJOR, DRIVER_NAME);
+    fop_stats_exit();
+
+    pwm_stop(&pwm);
+    stream_stop();
+    led_pm_disable(led_device);
+
+    device_destroy(led_class, MKDEV(DRIVER_MAJOR, 0));
+    class_destroy(led_class);
+
+    /* 取消映射 */
+    led_unmap();
 }
 
 /* 模块入口与出口 */
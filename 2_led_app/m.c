@@ -5,18 +5,259 @@
 #include "fcntl.h"
 #include "stdlib.h"
 #include "string.h"
+#include "time.h"
+#include "sys/ioctl.h"
+#include "sys/mman.h"
 
 #define LEDOFF   0 
 #define LEDON    1
 
+/* 流式输出配置，突发模式下 write 的采样立即连续输出 */
+#define LED_STREAM_CMD  _IOW(0xEF, 1, struct led_stream_cfg)
+#define STREAM_OFF          0
+#define STREAM_BURST        3
+#define STREAM_BURST_STRICT 4
+
+struct led_stream_cfg {
+    unsigned int format;
+    unsigned int rate_hz;
+};
+
+/* 软件 PWM 与渐变 */
+#define LED_PWM_CMD         _IOW(0xEF, 4, struct led_pwm_cfg)
+#define LED_FADE_CMD        _IOW(0xEF, 5, struct led_fade)
+#define LED_PWM_STATS_CMD   _IOR(0xEF, 6, struct led_pwm_stats)
+#define FADE_LINEAR     0
+#define FADE_EASE       1
+
+struct led_pwm_cfg {
+    unsigned int freq_hz;
+    unsigned int bits;
+};
+
+struct led_fade {
+    unsigned int brightness;
+    unsigned int duration_ms;
+    unsigned int curve;
+};
+
+struct led_pwm_stats {
+    unsigned long long periods;
+    unsigned long long edges;
+    unsigned long long late_avg_ns;
+    unsigned long long late_max_ns;
+};
+
+/* 屏蔽的置位/清零窗口 */
+#define LED_GPIO_SETCLR_CMD _IOW(0xEF, 2, struct led_gpio_setclr)
+#define LED_PIN_MASK    (1 << 3)
+
+struct led_gpio_setclr {
+    unsigned int set;
+    unsigned int clr;
+};
+
+/* 驱动的 MMIO 访问计数 */
+#define LED_MMIO_STATS_CMD  _IOR(0xEF, 3, struct led_mmio_stats)
+
+struct led_mmio_stats {
+    unsigned long long reads;
+    unsigned long long writes;
+};
+
+/* 输出两次计数之间每次操作的寄存器读写次数，驱动不支持时不输出 */
+static void print_mmio_per_op(int fd, struct led_mmio_stats *before, unsigned long count)
+{
+    struct led_mmio_stats after;
+
+    if (ioctl(fd, LED_MMIO_STATS_CMD, &after) < 0 || count == 0) {
+        return;
+    }
+    printf("        mmio per op: %.2f reads, %.2f writes\n",
+           (double)(after.reads - before->reads) / count,
+           (double)(after.writes - before->writes) / count);
+}
+
+static double elapsed(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/*
+ * 连续翻转 count 次，分别测试 write()、置位/清零 ioctl 与 mmap 寄存器页
+ * 三种方式，输出每秒翻转次数。mmap 需要 CAP_SYS_RAWIO，不允许时跳过。
+ */
+static int toggle_bench(int fd, unsigned long count)
+{
+    struct timespec t0, t1;
+    struct led_gpio_setclr sc;
+    struct led_mmio_stats st;
+    unsigned char databuf[1];
+    volatile unsigned int *dr = NULL;
+    unsigned int shadow = 0;
+    unsigned long i = 0;
+
+    ioctl(fd, LED_MMIO_STATS_CMD, &st);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < count; i++) {
+        databuf[0] = i & 1;
+        if (write(fd, databuf, 1) < 0) {
+            printf("LED Control Failed!\n");
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("write:  %lu toggles in %.3f s, %.0f toggles/s\n",
+           count, elapsed(&t0, &t1), count / elapsed(&t0, &t1));
+    print_mmio_per_op(fd, &st, count);
+
+    ioctl(fd, LED_MMIO_STATS_CMD, &st);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < count; i++) {
+        sc.set = (i & 1) ? LED_PIN_MASK : 0;
+        sc.clr = (i & 1) ? 0 : LED_PIN_MASK;
+        if (ioctl(fd, LED_GPIO_SETCLR_CMD, &sc) < 0) {
+            printf("LED_GPIO_SETCLR_CMD failed.\n");
+            return -1;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("setclr: %lu toggles in %.3f s, %.0f toggles/s\n",
+           count, elapsed(&t0, &t1), count / elapsed(&t0, &t1));
+    print_mmio_per_op(fd, &st, count);
+
+    dr = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (dr == MAP_FAILED) {
+        printf("mmap:   skipped, mmap failed.\n");
+        return 0;
+    }
+    shadow = dr[0];
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < count; i++) {
+        shadow ^= LED_PIN_MASK;
+        dr[0] = shadow;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("mmap:   %lu toggles in %.3f s, %.0f toggles/s\n",
+           count, elapsed(&t0, &t1), count / elapsed(&t0, &t1));
+    munmap((void *)dr, getpagesize());
+
+    return 0;
+}
+
+/*
+ * 突发输出 count 个交替位图，分别用逐次带屏障的 writel 与 relaxed 写加
+ * 一次屏障两种路径，输出每秒边沿数。sim=1 加载时测的是模拟寄存器。
+ */
+static int burst_bench(int fd, unsigned long count)
+{
+    static const unsigned int formats[] = { STREAM_BURST_STRICT, STREAM_BURST };
+    static const char *names[] = { "strict: ", "relaxed:" };
+    struct led_stream_cfg cfg = { STREAM_OFF, 0 };
+    struct led_mmio_stats st;
+    struct timespec t0, t1;
+    unsigned int *samples = NULL;
+    unsigned long i = 0;
+    size_t done = 0;
+    ssize_t ret = 0;
+    int f = 0;
+
+    samples = malloc(count * sizeof(*samples));
+    if (samples == NULL || count == 0) {
+        free(samples);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        samples[i] = (i & 1) ? LED_PIN_MASK : 0;
+    }
+
+    for (f = 0; f < 2; f++) {
+        cfg.format = formats[f];
+        if (ioctl(fd, LED_STREAM_CMD, &cfg) < 0) {
+            printf("LED_STREAM_CMD failed.\n");
+            free(samples);
+            return -1;
+        }
+        ioctl(fd, LED_MMIO_STATS_CMD, &st);
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (done = 0; done < count * sizeof(*samples); done += ret) {
+            ret = write(fd, (char *)samples + done, count * sizeof(*samples) - done);
+            if (ret <= 0) {
+                printf("burst write failed.\n");
+                free(samples);
+                return -1;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        printf("%s %lu edges in %.3f s, %.0f edges/s\n",
+               names[f], count, elapsed(&t0, &t1), count / elapsed(&t0, &t1));
+        print_mmio_per_op(fd, &st, count);
+    }
+
+    cfg.format = STREAM_OFF;
+    ioctl(fd, LED_STREAM_CMD, &cfg);
+    free(samples);
+    return 0;
+}
+
+/*
+ * pwm <freq_hz> <bits>             开启软件 PWM，freq 为 0 关闭
+ * fade <brightness> <ms> [ease]    渐变到目标亮度
+ * pwmstats                         输出周期数与边沿延迟(抖动)
+ */
+static int pwm_cmd(int fd, int argc, char *argv[])
+{
+    struct led_pwm_cfg cfg;
+    struct led_fade fade;
+    struct led_pwm_stats st;
+
+    if (strcmp(argv[1], "pwm") == 0 && argc == 4) {
+        cfg.freq_hz = strtoul(argv[2], NULL, 0);
+        cfg.bits = strtoul(argv[3], NULL, 0);
+        return ioctl(fd, LED_PWM_CMD, &cfg);
+    }
+    if (strcmp(argv[1], "fade") == 0 && (argc == 4 || argc == 5)) {
+        fade.brightness = strtoul(argv[2], NULL, 0);
+        fade.duration_ms = strtoul(argv[3], NULL, 0);
+        fade.curve = (argc == 5 && strcmp(argv[4], "ease") == 0) ? FADE_EASE : FADE_LINEAR;
+        return ioctl(fd, LED_FADE_CMD, &fade);
+    }
+    if (strcmp(argv[1], "pwmstats") == 0 && argc == 2) {
+        if (ioctl(fd, LED_PWM_STATS_CMD, &st) < 0) {
+            return -1;
+        }
+        printf("periods %llu edges %llu late_avg_ns %llu late_max_ns %llu\n",
+               st.periods, st.edges, st.late_avg_ns, st.late_max_ns);
+        return 0;
+    }
+    printf("usage: pwm <freq_hz> <bits>, fade <brightness> <ms> [ease], pwmstats.\n");
+    return -1;
+}
+
 int main(int argc, char *argv[]) 
 { 
     int fd = 0;
     int ret = 0;
     unsigned char databuf[1];
     
-    if (argc != 2) {
-        printf("need 1 param.\n");
+    if (argc >= 2 && (strcmp(argv[1], "pwm") == 0 || strcmp(argv[1], "fade") == 0 ||
+                      strcmp(argv[1], "pwmstats") == 0)) {
+        fd = open("/dev/led", O_RDWR);
+        if (fd < 0) {
+            printf("open /dev/led failed.\n");
+            return -1;
+        }
+        ret = pwm_cmd(fd, argc, argv);
+        if (ret < 0) {
+            perror(argv[1]);
+        }
+        close(fd);
+        return ret;
+    }
+
+    if (argc != 2 && !(argc == 3 && (strcmp(argv[1], "bench") == 0 ||
+                                     strcmp(argv[1], "burst") == 0))) {
+        printf("need 1 param, or: bench <count>, burst <count>.\n");
         return -1;
     }
     
@@ -27,6 +268,17 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if (argc == 3 && strcmp(argv[1], "burst") == 0) {
+        ret = burst_bench(fd, strtoul(argv[2], NULL, 0));
+        close(fd);
+        return ret;
+    }
+    if (argc == 3) {
+        ret = toggle_bench(fd, strtoul(argv[2], NULL, 0));
+        close(fd);
+        return ret;
+    }
+
     databuf[0] = atoi(argv[1]); /* 要执行的操作：打开或关闭 */
     if ((databuf[0] != 0) && (databuf[0] !=1)) {
         printf("param out of range.\n");
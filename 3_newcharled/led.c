@@ -6,38 +6,225 @@
 #include <linux/io.h>
 #include <linux/cdev.h>
 #include <linux/device.h>
+#include <linux/of.h>
+#include <linux/of_address.h>
+#include <linux/spinlock.h>
+
+#include "../common/err_stats.h"
 
 #define DRIVER_NAME "led"    // 名字
-#define DEVID_COUNT 1
 
-/* LED设备结构体 */
+#define LEDOFF 0
+#define LEDON 1
+
+#define LEDARRAY_MAX_LEDS   32  /* 聚合设备一次写一个 u32 位图 */
+#define LEDARRAY_MAX_BANKS  8
+
+/* i.MX GPIO 控制器内的寄存器偏移 */
+#define GPIO_DR     0x00
+#define GPIO_GDIR   0x04
+
+#if 0
+/*
+ * 每个 reg 是一个 GPIO 控制器，led-pins 为 <bank 引脚> 对，bank 是 reg 的下标。
+ * 引脚复用与 GPIO 时钟由 pinctrl 或 bootloader 配置，驱动只管方向与电平。
+ */
+ledarray {
+    compatible = "alientek,ledarray";
+    status = "okay";
+    reg = <0x0209C000 0x4000    /* GPIO1 */
+           0x020AC000 0x4000>;  /* GPIO5 */
+    led-pins = <0 3  0 4  1 1  1 2>;
+    active-low;
+};
+#endif
+
+/* 一个 GPIO bank，影子寄存器保证写 LED 只需一次写 DR */
+struct ledarray_bank {
+    void __iomem *base;
+    u32 dr_shadow;
+    u32 pins;               /* 本 bank 上属于阵列的引脚 */
+};
+
+struct ledarray_led {
+    u8 bank;
+    u8 pin;
+    struct device *device;
+    struct err_stats errors;
+};
+
+/* LED设备结构体，次设备号 0..nr_leds-1 对应单个 LED，nr_leds 为聚合设备 */
 struct newchrled_dev {
     struct cdev cdev;       /* 字符设备 */
     dev_t devid;            /* 设备号 */
     struct class *class;    /* 类 */
-    struct device *device;  /* 设备 */
+    struct device *device;  /* 聚合设备 */
+    struct err_stats errors;  /* 聚合设备的写入错误 */
     int major;              /* 主设备号 */
     int minor;              /* 次设备号 */
+    struct device_node *nd; /* 设备节点 */
+    spinlock_t lock;        /* 保护所有 bank 的影子与寄存器写入 */
+    bool active_low;
+    int nr_leds;
+    int nr_banks;
+    struct ledarray_bank banks[LEDARRAY_MAX_BANKS];
+    struct ledarray_led leds[LEDARRAY_MAX_LEDS];
 };
 
 struct newchrled_dev newchrled; /* led设备 */
 
+/* 聚合设备的写格式，只有 mask 内的 LED 改变，4 字节写等价于 mask 全 1 */
+struct ledarray_update {
+    __u32 value;            /* bit i 为 1 表示点亮 LED i */
+    __u32 mask;
+};
+
+/* 从硬件重新同步影子，其他路径可能改过同一 bank 的其他引脚 */
+static void ledarray_sync(void)
+{
+    unsigned long flags;
+    int b = 0;
+
+    spin_lock_irqsave(&newchrled.lock, flags);
+    for (b = 0; b < newchrled.nr_banks; b++) {
+        newchrled.banks[b].dr_shadow = readl(newchrled.banks[b].base + GPIO_DR);
+    }
+    spin_unlock_irqrestore(&newchrled.lock, flags);
+}
+
+/* 按 bank 汇总后每个 bank 只写一次 DR，同一 bank 内的 LED 同时变化 */
+static void ledarray_set(u32 value, u32 mask)
+{
+    u32 set[LEDARRAY_MAX_BANKS] = { 0 };
+    u32 clr[LEDARRAY_MAX_BANKS] = { 0 };
+    struct ledarray_led *led = NULL;
+    struct ledarray_bank *bank = NULL;
+    unsigned long flags;
+    bool level = false;
+    int i = 0;
+
+    for (i = 0; i < newchrled.nr_leds; i++) {
+        if (!(mask & BIT(i))) {
+            continue;
+        }
+        led = &newchrled.leds[i];
+        level = !!(value & BIT(i)) ^ newchrled.active_low;
+        if (level) {
+            set[led->bank] |= BIT(led->pin);
+        } else {
+            clr[led->bank] |= BIT(led->pin);
+        }
+    }
+
+    spin_lock_irqsave(&newchrled.lock, flags);
+    for (i = 0; i < newchrled.nr_banks; i++) {
+        if (!(set[i] | clr[i])) {
+            continue;
+        }
+        bank = &newchrled.banks[i];
+        bank->dr_shadow = (bank->dr_shadow & ~clr[i]) | set[i];
+        writel(bank->dr_shadow, bank->base + GPIO_DR);
+    }
+    spin_unlock_irqrestore(&newchrled.lock, flags);
+}
+
+/* 当前点亮的 LED 位图 */
+static u32 ledarray_get(void)
+{
+    struct ledarray_led *led = NULL;
+    unsigned long flags;
+    u32 state = 0;
+    bool level = false;
+    int i = 0;
+
+    spin_lock_irqsave(&newchrled.lock, flags);
+    for (i = 0; i < newchrled.nr_leds; i++) {
+        led = &newchrled.leds[i];
+        level = !!(newchrled.banks[led->bank].dr_shadow & BIT(led->pin));
+        if (level ^ newchrled.active_low) {
+            state |= BIT(i);
+        }
+    }
+    spin_unlock_irqrestore(&newchrled.lock, flags);
+
+    return state;
+}
+
+/* 次设备号对应的 LED 下标，聚合设备返回 nr_leds */
+static int led_index(struct file *filp)
+{
+    return iminor(file_inode(filp)) - newchrled.minor;
+}
+
 static int led_open(struct inode *inode, struct file *filp)
 {
     filp->private_data = &newchrled;
+    /* 打开时同步一次，写路径不再读寄存器 */
+    ledarray_sync();
     return 0;
 }
 
-static ssize_t led_read(struct file *filp, char __user *buf,     
+static ssize_t led_read(struct file *filp, char __user *buf,
                                size_t cnt, loff_t *offt)
 {
-    return 0;
+    int idx = led_index(filp);
+    u32 state = ledarray_get();
+    u8 data = 0;
+
+    if (idx == newchrled.nr_leds) {
+        if (cnt < sizeof(state)) {
+            return -EINVAL;
+        }
+        if (copy_to_user(buf, &state, sizeof(state))) {
+            return -EFAULT;
+        }
+        return sizeof(state);
+    }
+
+    if (cnt < sizeof(data)) {
+        return -EINVAL;
+    }
+    data = (state & BIT(idx)) ? LEDON : LEDOFF;
+    if (copy_to_user(buf, &data, sizeof(data))) {
+        return -EFAULT;
+    }
+    return sizeof(data);
 }
 
-static ssize_t led_write(struct file *filp, const char __user *buf,  
+static ssize_t led_write(struct file *filp, const char __user *buf,
                                 size_t cnt, loff_t *offt)
 {
-    return 0;
+    struct ledarray_update upd = { 0, 0xFFFFFFFF };
+    int idx = led_index(filp);
+    u8 data = 0;
+
+    if (idx == newchrled.nr_leds) {
+        /* 聚合设备：4 字节位图或 8 字节 {value, mask} */
+        if (cnt != sizeof(upd.value) && cnt != sizeof(upd)) {
+            atomic_long_inc(&newchrled.errors.inval);
+            return -EINVAL;
+        }
+        if (copy_from_user(&upd, buf, cnt)) {
+            atomic_long_inc(&newchrled.errors.fault);
+            return -EFAULT;
+        }
+        ledarray_set(upd.value, upd.mask);
+        return cnt;
+    }
+
+    if (copy_from_user(&data, buf, sizeof(data))) {
+        atomic_long_inc(&newchrled.leds[idx].errors.fault);
+        dev_dbg_ratelimited(newchrled.leds[idx].device, "kernel write failed.\n");
+        return -EFAULT;
+    }
+    if ((data != LEDON) && (data != LEDOFF)) {
+        atomic_long_inc(&newchrled.leds[idx].errors.inval);
+        dev_dbg_ratelimited(newchrled.leds[idx].device, "param out of range.\n");
+        return -EINVAL;
+    }
+    ledarray_set(data == LEDON ? BIT(idx) : 0, BIT(idx));
+
+    return 1;
 }
 
 static int led_release(struct inode *inode, struct file *filp)
@@ -46,28 +233,121 @@ static int led_release(struct inode *inode, struct file *filp)
     return 0;
 }
 
-static struct file_operations led_fops = { 
+static struct file_operations led_fops = {
     .owner = THIS_MODULE,
-    .open = led_open, 
-    .read = led_read, 
-    .write = led_write, 
-    .release = led_release, 
+    .open = led_open,
+    .read = led_read,
+    .write = led_write,
+    .release = led_release,
+};
+
+static const struct attribute_group *ledarray_groups[] = {
+    &err_stats_group,
+    NULL,
 };
 
+static void ledarray_unmap(void)
+{
+    int b = 0;
+
+    for (b = 0; b < newchrled.nr_banks; b++) {
+        iounmap(newchrled.banks[b].base);
+    }
+    newchrled.nr_banks = 0;
+}
+
+/* 从设备树读取 LED 列表，映射用到的 bank 并把引脚设为输出 */
+static int ledarray_parse_dt(void)
+{
+    struct ledarray_bank *bank = NULL;
+    u32 pins[LEDARRAY_MAX_LEDS * 2];
+    int count = 0;
+    int i = 0;
+    u32 val = 0;
+
+    newchrled.nd = of_find_node_by_path("/ledarray");
+    if (newchrled.nd == NULL) {
+        return -EINVAL;
+    }
+
+    count = of_property_count_elems_of_size(newchrled.nd, "led-pins", sizeof(u32));
+    if (count <= 0 || count % 2 || count > (int)ARRAY_SIZE(pins)) {
+        printk("led-pins must hold 1 to %d <bank pin> pairs.\n", LEDARRAY_MAX_LEDS);
+        return -EINVAL;
+    }
+    if (of_property_read_u32_array(newchrled.nd, "led-pins", pins, count) < 0) {
+        return -EINVAL;
+    }
+    newchrled.active_low = of_property_read_bool(newchrled.nd, "active-low");
+
+    newchrled.nr_leds = count / 2;
+    for (i = 0; i < newchrled.nr_leds; i++) {
+        if (pins[2 * i] >= LEDARRAY_MAX_BANKS || pins[2 * i + 1] >= 32) {
+            printk("led %d: bad bank/pin %u/%u.\n", i, pins[2 * i], pins[2 * i + 1]);
+            return -EINVAL;
+        }
+        newchrled.leds[i].bank = pins[2 * i];
+        newchrled.leds[i].pin = pins[2 * i + 1];
+        newchrled.nr_banks = max_t(int, newchrled.nr_banks, pins[2 * i] + 1);
+    }
+
+    /* 每个 bank 只映射一次 */
+    for (i = 0; i < newchrled.nr_banks; i++) {
+        newchrled.banks[i].base = of_iomap(newchrled.nd, i);
+        if (!newchrled.banks[i].base) {
+            printk("bank %d has no reg entry.\n", i);
+            newchrled.nr_banks = i;
+            ledarray_unmap();
+            return -EINVAL;
+        }
+    }
+
+    for (i = 0; i < newchrled.nr_leds; i++) {
+        newchrled.banks[newchrled.leds[i].bank].pins |= BIT(newchrled.leds[i].pin);
+    }
+    for (i = 0; i < newchrled.nr_banks; i++) {
+        bank = &newchrled.banks[i];
+        if (!bank->pins) {
+            continue;
+        }
+        val = readl(bank->base + GPIO_GDIR);
+        writel(val | bank->pins, bank->base + GPIO_GDIR);
+    }
+    printk("ledarray: %d leds in %d banks\n", newchrled.nr_leds, newchrled.nr_banks);
+
+    return 0;
+}
+
+static void ledarray_destroy_devices(int cnt)
+{
+    int i = 0;
+
+    for (i = 0; i < cnt; i++) {
+        device_destroy(newchrled.class, newchrled.devid + i);
+    }
+}
+
 static int __init led_init(void)
 {
     int ret = 0;
+    int i = 0;
+
+    spin_lock_init(&newchrled.lock);
+    ret = ledarray_parse_dt();
+    if (ret < 0) {
+        goto fail_dt;
+    }
 
-    /* 注册设备号 */
+    /* 注册设备号，每个 LED 一个，加上一个聚合设备 */
     if (newchrled.major) {
         newchrled.devid = MKDEV(newchrled.major, 0);
-        ret = register_chrdev_region(newchrled.devid, DEVID_COUNT, DRIVER_NAME);
+        ret = register_chrdev_region(newchrled.devid, newchrled.nr_leds + 1, DRIVER_NAME);
         if (ret < 0) {
             printk("register_chrdev_region failed.\n");
             goto fail_devid;
         }
     } else {
-        ret = alloc_chrdev_region(&newchrled.devid, 0, DEVID_COUNT, DRIVER_NAME);
+        ret = alloc_chrdev_region(&newchrled.devid, 0, newchrled.nr_leds + 1, DRIVER_NAME);
         if (ret < 0) {
             printk("alloc_chrdev_region failed.\n");
             goto fail_devid;
@@ -77,11 +357,11 @@ static int __init led_init(void)
     }
     printk("newchrled major=%d, minor=%d\n", newchrled.major, newchrled.minor);
 
-    /* 注册字符设备 */
+    /* 注册字符设备，一个 cdev 覆盖全部次设备号 */
     newchrled.cdev.owner = THIS_MODULE;
     cdev_init(&newchrled.cdev, &led_fops);
     /* 添加字符设备 */
-    ret = cdev_add(&newchrled.cdev, newchrled.devid, DEVID_COUNT);
+    ret = cdev_add(&newchrled.cdev, newchrled.devid, newchrled.nr_leds + 1);
     if (ret < 0) {
         printk("cdev_add failed.\n");
         goto fail_cdev;
@@ -95,30 +375,50 @@ static int __init led_init(void)
         goto fail_class;
     }
 
-    /* 创建设备 */
-    newchrled.device = device_create(newchrled.class, NULL, newchrled.devid, NULL, DRIVER_NAME);
+    /* 创建设备，/dev/led0.. 与 /dev/ledarray */
+    for (i = 0; i < newchrled.nr_leds; i++) {
+        newchrled.leds[i].device = device_create_with_groups(newchrled.class, NULL,
+                                                             newchrled.devid + i,
+                                                             &newchrled.leds[i].errors,
+                                                             ledarray_groups, DRIVER_NAME "%d", i);
+        if (IS_ERR(newchrled.leds[i].device)) {
+            ret = PTR_ERR(newchrled.leds[i].device);
+            printk("device_create failed.\n");
+            goto fail_device;
+        }
+    }
+    newchrled.device = device_create_with_groups(newchrled.class, NULL, newchrled.devid + i,
+                                                 &newchrled.errors, ledarray_groups,
+                                                 DRIVER_NAME "array");
     if (IS_ERR(newchrled.device)) {
         ret = PTR_ERR(newchrled.device);
         printk("device_create failed.\n");
         goto fail_device;
     }
-    
+
+    /* 默认全部熄灭 */
+    ledarray_sync();
+    ledarray_set(0, 0xFFFFFFFF);
+
     return 0;
 
 fail_device:
+    ledarray_destroy_devices(i);
     class_destroy(newchrled.class);
 fail_class:
     cdev_del(&newchrled.cdev);
 fail_cdev:
-    unregister_chrdev_region(newchrled.devid, DEVID_COUNT);
+    unregister_chrdev_region(newchrled.devid, newchrled.nr_leds + 1);
 fail_devid:
+    ledarray_unmap();
+fail_dt:
     return ret;
 }
 
 static void __exit led_exit(void)
 {
     /* 销毁设备 */
-    device_destroy(newchrled.class, newchrled.devid);
+    ledarray_destroy_devices(newchrled.nr_leds + 1);
 
     /* 销毁类 */
     class_destroy(newchrled.class);
@@ -127,7 +427,10 @@ static void __exit led_exit(void)
     cdev_del(&newchrled.cdev);
 
     /* 注销字符设备驱动 */
-    unregister_chrdev_region(newchrled.devid, DEVID_COUNT);
+    unregister_chrdev_region(newchrled.devid, newchrled.nr_leds + 1);
+
+    /* 取消映射 */
+    ledarray_unmap();
 }
 
 /* 模块入口与出口 */
@@ -0,0 +1,121 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+
+/*
+./ledarray_app set <mask>       点亮 mask 中的 LED，其余熄灭
+./ledarray_app get              读取当前点亮的 LED 位图
+./ledarray_app bench <n> <count>
+    对前 n 个 LED 交替全亮全灭 count 次，分别用 /dev/led0.. 逐个写和
+    /dev/ledarray 一次写位图，输出每秒更新次数
+*/
+
+#define LEDOFF   0
+#define LEDON    1
+#define MAX_LEDS 32
+
+static double elapsed(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static int array_bench(int afd, int n, unsigned long count)
+{
+    struct timespec t0, t1;
+    char path[32];
+    int fds[MAX_LEDS];
+    unsigned char databuf[1];
+    unsigned int mask = 0;
+    unsigned long i = 0;
+    int j = 0;
+    int ret = 0;
+
+    for (j = 0; j < n; j++) {
+        snprintf(path, sizeof(path), "/dev/led%d", j);
+        fds[j] = open(path, O_RDWR);
+        if (fds[j] < 0) {
+            printf("open %s failed.\n", path);
+            n = j;
+            ret = -1;
+            goto out;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < count; i++) {
+        databuf[0] = (i & 1) ? LEDON : LEDOFF;
+        for (j = 0; j < n; j++) {
+            if (write(fds[j], databuf, 1) < 0) {
+                printf("LED Control Failed!\n");
+                ret = -1;
+                goto out;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("per-led:   %lu updates of %d leds in %.3f s, %.0f updates/s, %d syscalls each\n",
+           count, n, elapsed(&t0, &t1), count / elapsed(&t0, &t1), n);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < count; i++) {
+        mask = (i & 1) ? (unsigned int)((1ULL << n) - 1) : 0;
+        if (write(afd, &mask, sizeof(mask)) < 0) {
+            printf("LED Control Failed!\n");
+            ret = -1;
+            goto out;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("aggregate: %lu updates of %d leds in %.3f s, %.0f updates/s, 1 syscall each\n",
+           count, n, elapsed(&t0, &t1), count / elapsed(&t0, &t1));
+
+out:
+    for (j = 0; j < n; j++) {
+        close(fds[j]);
+    }
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    int fd = 0;
+    int ret = 0;
+    unsigned int mask = 0;
+
+    if (!(argc == 3 && strcmp(argv[1], "set") == 0) &&
+        !(argc == 2 && strcmp(argv[1], "get") == 0) &&
+        !(argc == 4 && strcmp(argv[1], "bench") == 0)) {
+        printf("usage: set <mask>, get, bench <n> <count>.\n");
+        return -1;
+    }
+
+    /* 打开聚合设备 */
+    fd = open("/dev/ledarray", O_RDWR);
+    if (fd < 0) {
+        printf("open /dev/ledarray failed.\n");
+        return -1;
+    }
+
+    if (strcmp(argv[1], "set") == 0) {
+        mask = strtoul(argv[2], NULL, 0);
+        ret = write(fd, &mask, sizeof(mask)) < 0 ? -1 : 0;
+    } else if (strcmp(argv[1], "get") == 0) {
+        ret = read(fd, &mask, sizeof(mask)) < 0 ? -1 : 0;
+        printf("%#x\n", mask);
+    } else {
+        if (atoi(argv[2]) < 1 || atoi(argv[2]) > MAX_LEDS) {
+            printf("param out of range.\n");
+            close(fd);
+            return -1;
+        }
+        ret = array_bench(fd, atoi(argv[2]), strtoul(argv[3], NULL, 0));
+    }
+
+    close(fd);
+    return ret;
+}
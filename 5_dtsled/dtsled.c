@@ -10,13 +10,75 @@
 #include <linux/of_address.h>
 #include <linux/of_irq.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/capability.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include <linux/pm_runtime.h>
+
+#include "../common/err_stats.h"
 
 #define DTSLED_CNT 1            /* 设备号个数 */
+#define DTSLED_REG_CNT 5        /* 设备树 reg 中的寄存器个数 */
 #define DTSLED_NAME "dtsled"    /* 名字 */
 
 #define LEDOFF 0
 #define LEDON 1
 
+#define LED_PIN_MASK (1 << 3)   // 默认授权的 GPIO1 引脚，设备树 grant-mask 可覆盖
+#define CCGR1_GPIO1_CG (0b11 << 26)    // CCM_CCGR1 中 GPIO1 的时钟门控位
+
+/* 流式输出，一次 write 提交大量采样，由 hrtimer 按时间播放 */
+#define LED_STREAM_CMD  _IOW(0xEF, 1, struct led_stream_cfg)    // 配置流式输出
+
+#define STREAM_OFF      0   /* 关闭，write 为原来的单字节 LEDON/LEDOFF */
+#define STREAM_MASK     1   /* 每个采样一个 u32 GPIO1 位图，按 rate_hz 播放 */
+#define STREAM_TIMED    2   /* 每个采样 {value, hold_us}，输出 value 后保持 hold_us */
+#define STREAM_BURST    3   /* 每个采样一个 u32 位图，write 内立即连续输出 */
+#define STREAM_BURST_STRICT 4   /* 同 STREAM_BURST，但每次写都带屏障，仅用于对比 */
+
+#define BURST_CHUNK     64  /* 突发输出每次持锁处理的采样数 */
+
+#define STREAM_FIFO_SIZE 4096   /* u32 个数，必须是 2 的幂 */
+/*
+ * STREAM_MASK 的最高采样率。每个采样是一次 hrtimer 硬中断回调(进出中断、取 FIFO、
+ * 写 DR、唤醒写者、重设定时器)，Cortex-A7 上估计每次数微秒，20 kHz 时已占一成以上 CPU，
+ * 再高会先饿死其他任务，等不到回调落后时的重新计时起作用
+ */
+#define STREAM_MAX_HZ   20000
+#define STREAM_MIN_NS   (NSEC_PER_SEC / STREAM_MAX_HZ)  /* 每个采样至少保持的时间，hold_us 为 0 也按此计 */
+
+struct led_stream_cfg {
+    __u32 format;
+    __u32 rate_hz;      /* 仅 STREAM_MASK 使用 */
+};
+
+struct led_sample_timed {
+    __u32 value;        /* GPIO1_DR 位图，只有授权引脚的位生效 */
+    __u32 hold_us;
+};
+
+/* 读取 MMIO 访问计数，用于统计每次操作的寄存器访问次数 */
+#define LED_MMIO_STATS_CMD  _IOR(0xEF, 3, struct led_mmio_stats)
+
+struct led_mmio_stats {
+    __u64 reads;
+    __u64 writes;
+};
+
+/* 屏蔽的置位/清零窗口，只作用于授权引脚，一次写寄存器完成 */
+#define LED_GPIO_SETCLR_CMD _IOW(0xEF, 2, struct led_gpio_setclr)
+
+struct led_gpio_setclr {
+    __u32 set;
+    __u32 clr;
+};
+
 /* 映射后的寄存器虚拟地址指针 */
 // __iomem 是 Linux 内核中一个关键字，用来标记内存映射 I/O 区域的指针
 static void __iomem *CCM_CCGR1;
@@ -25,6 +87,72 @@ static void __iomem *SW_PAD_GPIO1_IO03;
 static void __iomem *GPIO1_GDIR;
 static void __iomem *GPIO1_DR;
 
+/*
+ * 模拟寄存器后端，sim=1 时寄存器落在 vmalloc 的内存里，驱动可以在
+ * x86 或 QEMU 上不依赖设备树加载测试，页内偏移与 i.MX6ULL 一致。
+ */
+#define SIM_PAGE_CCM    0
+#define SIM_PAGE_IOMUXC 1
+#define SIM_PAGE_GPIO1  2
+#define SIM_PAGES       3
+#define SIM_CCM_CCGR1_OFF           0x06C
+#define SIM_SW_MUX_GPIO1_IO03_OFF   0x068
+#define SIM_SW_PAD_GPIO1_IO03_OFF   0x2F4
+#define SIM_GPIO1_GDIR_OFF          0x004
+#define SIM_GPIO1_DR_OFF            0x000
+#define SIM_REG(page, off) ((void __iomem *)(sim_regs + (page) * PAGE_SIZE + (off)))
+
+static bool sim;
+module_param(sim, bool, 0444);
+MODULE_PARM_DESC(sim, "use a vmalloc'd simulated register file instead of the device tree registers");
+
+static char *sim_regs;
+
+static int autosuspend_ms = 2000;
+module_param(autosuspend_ms, int, 0444);
+MODULE_PARM_DESC(autosuspend_ms, "idle time in ms before the GPIO1 clock is gated, negative never gates");
+
+/* MMIO 访问计数，每 CPU 一份，读取时求和 */
+static DEFINE_PER_CPU(unsigned long, mmio_reads);
+static DEFINE_PER_CPU(unsigned long, mmio_writes);
+
+/* 所有寄存器访问都经过这里，计数并可通过 dynamic debug 跟踪 */
+static inline u32 led_readl(const void __iomem *addr)
+{
+    u32 val = readl(addr);
+
+    this_cpu_inc(mmio_reads);
+    pr_debug("mmio r %p = %#x\n", addr, val);
+    return val;
+}
+
+static inline void led_writel(u32 val, void __iomem *addr)
+{
+    writel(val, addr);
+    this_cpu_inc(mmio_writes);
+    pr_debug("mmio w %p = %#x\n", addr, val);
+}
+
+/* 不带屏障的写，只在突发路径中使用，整段写完后由调用者补一次 wmb() */
+static inline void led_writel_relaxed(u32 val, void __iomem *addr)
+{
+    writel_relaxed(val, addr);
+    this_cpu_inc(mmio_writes);
+    pr_debug("mmio w %p = %#x (relaxed)\n", addr, val);
+}
+
+static void led_mmio_stats(struct led_mmio_stats *st)
+{
+    int cpu = 0;
+
+    st->reads = 0;
+    st->writes = 0;
+    for_each_possible_cpu(cpu) {
+        st->reads += per_cpu(mmio_reads, cpu);
+        st->writes += per_cpu(mmio_writes, cpu);
+    }
+}
+
 /* dtsled 设备结构体 */
 struct dtsled_dev {
     dev_t devid;            /* 设备号 */
@@ -34,21 +162,520 @@ struct dtsled_dev {
     struct class *class;    /* 类 */
     struct device *device;  /* 设备 */
     struct device_node *nd; /* 设备节点 */
+    spinlock_t lock;        /* 保护 GPIO1_DR 影子与寄存器写入 */
+    u32 dr_shadow;          /* GPIO1_DR 影子寄存器，翻转时只写不读 */
+    u32 grant_mask;         /* 设备树授权给本设备的 GPIO1 引脚 */
+    phys_addr_t dr_phys;    /* GPIO1_DR 物理地址，mmap 使用 */
+    atomic_t raw_maps;      /* 寄存器页的用户空间映射数 */
+    void __iomem *reg_pages[DTSLED_REG_CNT];    /* 寄存器所在的页，每页只映射一次 */
+    int nr_reg_pages;
+
+    /* 流式输出，stream_running 与 GPIO1 一起由 lock 保护 */
+    DECLARE_KFIFO(stream_fifo, u32, STREAM_FIFO_SIZE);
+    wait_queue_head_t stream_wq;
+    struct mutex stream_mutex;  /* 串行化多个写者与配置 */
+    struct hrtimer stream_timer;
+    u32 stream_format;
+    u64 stream_period_ns;
+    bool stream_running;
+
+    /* 运行时 PM 统计与系统睡眠时保存的寄存器 */
+    struct {
+        spinlock_t lock;
+        unsigned long suspends;
+        unsigned long resumes;
+        unsigned long wakeups;  /* led_pm_get 中需要唤醒的次数 */
+        u64 wake_ns;
+        u64 wake_max_ns;
+        u32 mux;                /* 系统睡眠时保存的寄存器 */
+        u32 pad;
+        u32 gdir;
+    } pm;
+
+    struct err_stats errors;
 };
 
 struct dtsled_dev dtsled;   /* led 设备 */
 
+/* 从硬件重新同步影子，其他路径修改过 GPIO1 后调用 */
+static void gpio1_dr_sync(void)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&dtsled.lock, flags);
+    dtsled.dr_shadow = led_readl(GPIO1_DR);
+    spin_unlock_irqrestore(&dtsled.lock, flags);
+}
+
+/* 寄存器页映射到用户空间期间影子可能过期，先回读，调用者持有 dtsled.lock */
+static inline void gpio1_dr_refresh(void)
+{
+    if (atomic_read(&dtsled.raw_maps)) {
+        dtsled.dr_shadow = led_readl(GPIO1_DR);
+    }
+}
+
 static void led_switch(u8 sta)
 {
-    u32 val = 0;
+    unsigned long flags;
+
+    spin_lock_irqsave(&dtsled.lock, flags);
+    gpio1_dr_refresh();
     if (sta == LEDON) {
-        val = readl(GPIO1_DR);
-        val &= ~(1 << 3);   // bit3置0
-        writel(val, GPIO1_DR);
+        dtsled.dr_shadow &= ~(1 << 3);  // bit3置0
     } else if (sta == LEDOFF) {
-        val = readl(GPIO1_DR);
-        val|= (1 << 3);     // bit3置1
-        writel(val, GPIO1_DR);
+        dtsled.dr_shadow |= (1 << 3);   // bit3置1
+    }
+    led_writel(dtsled.dr_shadow, GPIO1_DR);
+    spin_unlock_irqrestore(&dtsled.lock, flags);
+}
+
+/* 只修改本驱动占用的引脚，调用者持有 dtsled.lock */
+static void gpio1_write_masked(u32 val)
+{
+    gpio1_dr_refresh();
+    dtsled.dr_shadow = (dtsled.dr_shadow & ~dtsled.grant_mask) | (val & dtsled.grant_mask);
+    led_writel(dtsled.dr_shadow, GPIO1_DR);
+}
+
+/* GPIO1 时钟门控，运行时 PM 在空闲 autosuspend_ms 后关闭时钟 */
+static void gpio1_clk_set(bool on)
+{
+    u32 val = led_readl(CCM_CCGR1);    /* CCGR1 与其他外设共用，读-改-写 */
+
+    if (on) {
+        val |= CCGR1_GPIO1_CG;
+    } else {
+        val &= ~CCGR1_GPIO1_CG;
+    }
+    led_writel(val, CCM_CCGR1);
+}
+
+/* 访问寄存器前调用，时钟已关闭时同步打开并记录唤醒耗时 */
+static int led_pm_get(void)
+{
+    bool cold = pm_runtime_suspended(dtsled.device);
+    ktime_t t0 = ktime_get();
+    unsigned long flags;
+    u64 ns = 0;
+    int ret = 0;
+
+    ret = pm_runtime_get_sync(dtsled.device);
+    if (ret < 0) {
+        pm_runtime_put_noidle(dtsled.device);
+        return ret;
+    }
+
+    if (cold) {
+        ns = ktime_to_ns(ktime_sub(ktime_get(), t0));
+        spin_lock_irqsave(&dtsled.pm.lock, flags);
+        dtsled.pm.wakeups++;
+        dtsled.pm.wake_ns += ns;
+        dtsled.pm.wake_max_ns = max(dtsled.pm.wake_max_ns, ns);
+        spin_unlock_irqrestore(&dtsled.pm.lock, flags);
+    }
+    return 0;
+}
+
+static void led_pm_put(void)
+{
+    pm_runtime_mark_last_busy(dtsled.device);
+    pm_runtime_put_autosuspend(dtsled.device);
+}
+
+static int __maybe_unused dtsled_runtime_suspend(struct device *dev)
+{
+    gpio1_clk_set(false);
+    dtsled.pm.suspends++;
+    return 0;
+}
+
+static int __maybe_unused dtsled_runtime_resume(struct device *dev)
+{
+    gpio1_clk_set(true);
+    dtsled.pm.resumes++;
+    return 0;
+}
+
+/* 系统睡眠时 IOMUXC 与 GPIO 可能掉电，保存并恢复复用、电气属性与方向 */
+static int __maybe_unused dtsled_suspend(struct device *dev)
+{
+    gpio1_clk_set(true);
+    dtsled.pm.mux = led_readl(SW_MUX_GPIO1_IO03);
+    dtsled.pm.pad = led_readl(SW_PAD_GPIO1_IO03);
+    dtsled.pm.gdir = led_readl(GPIO1_GDIR);
+    if (pm_runtime_status_suspended(dev)) {
+        gpio1_clk_set(false);
+    }
+    return 0;
+}
+
+static int __maybe_unused dtsled_resume(struct device *dev)
+{
+    unsigned long flags;
+
+    gpio1_clk_set(true);
+    led_writel(dtsled.pm.mux, SW_MUX_GPIO1_IO03);
+    led_writel(dtsled.pm.pad, SW_PAD_GPIO1_IO03);
+    led_writel(dtsled.pm.gdir, GPIO1_GDIR);
+    spin_lock_irqsave(&dtsled.lock, flags);
+    led_writel(dtsled.dr_shadow, GPIO1_DR);
+    spin_unlock_irqrestore(&dtsled.lock, flags);
+    if (pm_runtime_status_suspended(dev)) {
+        gpio1_clk_set(false);
+    }
+    return 0;
+}
+
+static const struct dev_pm_ops dtsled_pm_ops = {
+    SET_SYSTEM_SLEEP_PM_OPS(dtsled_suspend, dtsled_resume)
+    SET_RUNTIME_PM_OPS(dtsled_runtime_suspend, dtsled_runtime_resume, NULL)
+};
+
+static ssize_t pm_stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    unsigned long flags;
+    ssize_t len = 0;
+
+    spin_lock_irqsave(&dtsled.pm.lock, flags);
+    len = sprintf(buf, "suspends %lu\nresumes %lu\nwakeups %lu\nwake_avg_ns %llu\nwake_max_ns %llu\n",
+                  dtsled.pm.suspends, dtsled.pm.resumes, dtsled.pm.wakeups,
+                  dtsled.pm.wakeups ? div64_u64(dtsled.pm.wake_ns, dtsled.pm.wakeups) : 0,
+                  dtsled.pm.wake_max_ns);
+    spin_unlock_irqrestore(&dtsled.pm.lock, flags);
+
+    return len;
+}
+static DEVICE_ATTR_RO(pm_stats);
+
+static struct attribute *dtsled_attrs[] = {
+    &dev_attr_pm_stats.attr,
+    NULL,
+};
+
+static const struct attribute_group dtsled_group = {
+    .attrs = dtsled_attrs,
+};
+
+static const struct attribute_group *dtsled_groups[] = {
+    &dtsled_group,
+    &err_stats_group,
+    NULL,
+};
+
+/* 初始化完成时时钟是开着的，空闲 autosuspend_ms 后关闭，负值表示不关闭 */
+static void led_pm_enable(struct device *dev)
+{
+    pm_runtime_set_active(dev);
+    pm_runtime_set_autosuspend_delay(dev, autosuspend_ms);
+    pm_runtime_use_autosuspend(dev);
+    pm_runtime_enable(dev);
+    pm_runtime_mark_last_busy(dev);
+    pm_request_autosuspend(dev);
+}
+
+/* 卸载时恢复原来的状态：时钟保持打开 */
+static void led_pm_disable(struct device *dev)
+{
+    pm_runtime_disable(dev);
+    pm_runtime_dont_use_autosuspend(dev);
+    if (pm_runtime_status_suspended(dev)) {
+        gpio1_clk_set(true);
+    }
+    pm_runtime_set_suspended(dev);
+}
+
+static enum hrtimer_restart stream_timer_func(struct hrtimer *timer)
+{
+    struct led_sample_timed sample;
+    ktime_t now = hrtimer_cb_get_time(timer);
+    u64 hold_ns = 0;
+
+    spin_lock(&dtsled.lock);
+    if (dtsled.stream_format == STREAM_MASK) {
+        if (!kfifo_get(&dtsled.stream_fifo, &sample.value)) {
+            goto stop;
+        }
+        hold_ns = dtsled.stream_period_ns;
+    } else {
+        if (kfifo_out(&dtsled.stream_fifo, (u32 *)&sample, 2) != 2) {
+            goto stop;
+        }
+        hold_ns = (u64)sample.hold_us * NSEC_PER_USEC;
+    }
+    gpio1_write_masked(sample.value);
+    spin_unlock(&dtsled.lock);
+
+    wake_up_interruptible(&dtsled.stream_wq);
+    /* 按绝对时间推进，不累积回调延迟；已落后时从当前时刻重新计时，不在中断里连续补播 */
+    hold_ns = max_t(u64, hold_ns, STREAM_MIN_NS);
+    hrtimer_add_expires_ns(timer, hold_ns);
+    if (ktime_before(hrtimer_get_expires(timer), now)) {
+        hrtimer_set_expires(timer, ktime_add_ns(now, hold_ns));
+    }
+    return HRTIMER_RESTART;
+
+stop:
+    dtsled.stream_running = false;
+    spin_unlock(&dtsled.lock);
+    wake_up_interruptible(&dtsled.stream_wq);
+    return HRTIMER_NORESTART;
+}
+
+static void stream_stop(void)
+{
+    unsigned long flags;
+
+    hrtimer_cancel(&dtsled.stream_timer);
+    spin_lock_irqsave(&dtsled.lock, flags);
+    dtsled.stream_running = false;
+    kfifo_reset(&dtsled.stream_fifo);
+    spin_unlock_irqrestore(&dtsled.lock, flags);
+}
+
+/*
+ * 突发输出一组位图，调用者持有 dtsled.lock。
+ * ARM 上每次 writel 都带一次 wmb，而同一设备的 relaxed 写之间本身保序，
+ * 所以整段用 writel_relaxed，最后只做一次 wmb()，让这些写排在之后的写(包括解锁)
+ * 之前。wmb() 只保证顺序，不等写入到达设备，这里也不需要。
+ * strict 为真时逐次使用 writel，用于对比两种路径。
+ */
+static void gpio1_write_burst(const u32 *vals, unsigned int n, bool strict)
+{
+    unsigned int i = 0;
+
+    gpio1_dr_refresh();
+    for (i = 0; i < n; i++) {
+        dtsled.dr_shadow = (dtsled.dr_shadow & ~dtsled.grant_mask) | (vals[i] & dtsled.grant_mask);
+        if (strict) {
+            led_writel(dtsled.dr_shadow, GPIO1_DR);
+        } else {
+            led_writel_relaxed(dtsled.dr_shadow, GPIO1_DR);
+        }
+    }
+    if (!strict) {
+        wmb();
+    }
+}
+
+/* STREAM_BURST 下的 write，分块拷贝后持锁连续输出，不经过 FIFO 与定时器 */
+static ssize_t burst_write(const char __user *buf, size_t cnt)
+{
+    u32 vals[BURST_CHUNK];
+    size_t done = 0;
+    size_t len = 0;
+    unsigned long flags;
+    bool strict = false;
+
+    cnt -= cnt % sizeof(u32);
+    if (cnt == 0) {
+        return -EINVAL;
+    }
+    if (mutex_lock_interruptible(&dtsled.stream_mutex)) {
+        return -ERESTARTSYS;
+    }
+
+    strict = (dtsled.stream_format == STREAM_BURST_STRICT);
+    while (done < cnt) {
+        len = min_t(size_t, cnt - done, sizeof(vals));
+        if (copy_from_user(vals, buf + done, len)) {
+            break;
+        }
+        spin_lock_irqsave(&dtsled.lock, flags);
+        gpio1_write_burst(vals, len / sizeof(u32), strict);
+        spin_unlock_irqrestore(&dtsled.lock, flags);
+        done += len;
+    }
+    mutex_unlock(&dtsled.stream_mutex);
+
+    return done ? done : -EFAULT;
+}
+
+static int stream_config(struct led_stream_cfg *cfg)
+{
+    int ret = 0;
+
+    if (cfg->format > STREAM_BURST_STRICT) {
+        return -EINVAL;
+    }
+    if (cfg->format == STREAM_MASK && (cfg->rate_hz == 0 || cfg->rate_hz > STREAM_MAX_HZ)) {
+        return -EINVAL;
+    }
+
+    mutex_lock(&dtsled.stream_mutex);
+    /* 流式与突发模式下定时器和写路径随时访问寄存器，期间一直持有 PM 引用 */
+    if (cfg->format != STREAM_OFF && dtsled.stream_format == STREAM_OFF) {
+        ret = led_pm_get();
+        if (ret) {
+            mutex_unlock(&dtsled.stream_mutex);
+            return ret;
+        }
+    }
+    stream_stop();
+    if (cfg->format == STREAM_OFF && dtsled.stream_format != STREAM_OFF) {
+        led_pm_put();
+    }
+    dtsled.stream_format = cfg->format;
+    dtsled.stream_period_ns = cfg->rate_hz ? div_u64(NSEC_PER_SEC, cfg->rate_hz) : 0;
+    mutex_unlock(&dtsled.stream_mutex);
+
+    return 0;
+}
+
+/* 写入采样，FIFO 满时阻塞，O_NONBLOCK 时返回已写入的部分或 -EAGAIN */
+static ssize_t stream_write(struct file *filp, const char __user *buf, size_t cnt)
+{
+    size_t sample_size = 0;
+    size_t done = 0;
+    size_t len = 0;
+    unsigned int copied = 0;
+    unsigned long flags;
+    int ret = 0;
+
+    if (mutex_lock_interruptible(&dtsled.stream_mutex)) {
+        return -ERESTARTSYS;
+    }
+
+    sample_size = (dtsled.stream_format == STREAM_MASK) ? sizeof(u32) : sizeof(struct led_sample_timed);
+    cnt -= cnt % sample_size;
+    if (dtsled.stream_format == STREAM_OFF || cnt == 0) {
+        ret = -EINVAL;
+    }
+
+    while (ret == 0 && done < cnt) {
+        if (kfifo_avail(&dtsled.stream_fifo) * sizeof(u32) < sample_size) {
+            if (filp->f_flags & O_NONBLOCK) {
+                ret = -EAGAIN;
+                break;
+            }
+            ret = wait_event_interruptible(dtsled.stream_wq,
+                    kfifo_avail(&dtsled.stream_fifo) * sizeof(u32) >= sample_size);
+            if (ret) {
+                break;
+            }
+        }
+
+        len = min_t(size_t, cnt - done, kfifo_avail(&dtsled.stream_fifo) * sizeof(u32));
+        len -= len % sample_size;
+        ret = kfifo_from_user(&dtsled.stream_fifo, buf + done, len, &copied);
+        if (ret) {
+            break;
+        }
+        done += copied;
+
+        /* 定时器已停止时重新启动，判断与回调中的停止在同一把锁下 */
+        spin_lock_irqsave(&dtsled.lock, flags);
+        if (!dtsled.stream_running) {
+            dtsled.stream_running = true;
+            hrtimer_start(&dtsled.stream_timer, ktime_get(), HRTIMER_MODE_ABS);
+        }
+        spin_unlock_irqrestore(&dtsled.lock, flags);
+    }
+    mutex_unlock(&dtsled.stream_mutex);
+
+    return done ? done : ret;
+}
+
+static void gpio1_setclr(u32 set, u32 clr)
+{
+    unsigned long flags;
+
+    set &= dtsled.grant_mask;
+    clr &= dtsled.grant_mask;
+
+    spin_lock_irqsave(&dtsled.lock, flags);
+    gpio1_dr_refresh();
+    dtsled.dr_shadow = (dtsled.dr_shadow & ~clr) | set;
+    led_writel(dtsled.dr_shadow, GPIO1_DR);
+    spin_unlock_irqrestore(&dtsled.lock, flags);
+}
+
+static void dtsled_vma_open(struct vm_area_struct *vma)
+{
+    /* 映射期间用户空间随时访问寄存器，时钟必须一直开着 */
+    pm_runtime_get_sync(dtsled.device);
+    atomic_inc(&dtsled.raw_maps);
+}
+
+static void dtsled_vma_close(struct vm_area_struct *vma)
+{
+    /* 最后一个映射解除后影子重新以硬件为准 */
+    if (atomic_dec_and_test(&dtsled.raw_maps)) {
+        gpio1_dr_sync();
+    }
+    led_pm_put();
+}
+
+static const struct vm_operations_struct dtsled_vm_ops = {
+    .open = dtsled_vma_open,
+    .close = dtsled_vma_close,
+};
+
+/*
+ * 把 GPIO1 寄存器页映射到用户空间，翻转不再需要系统调用。
+ * 硬件无法按引脚限制页内访问，所以只有设备树授权了整个 bank 或调用者有
+ * CAP_SYS_RAWIO 时才允许，其他情况使用 LED_GPIO_SETCLR_CMD。
+ */
+static int dtsled_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE) {
+        return -EINVAL;
+    }
+    if (dtsled.grant_mask != 0xFFFFFFFF && !capable(CAP_SYS_RAWIO)) {
+        return -EPERM;
+    }
+
+    if (sim) {
+        if (remap_vmalloc_range(vma, sim_regs, SIM_PAGE_GPIO1)) {
+            return -EAGAIN;
+        }
+    } else {
+        vma->vm_flags |= VM_IO | VM_DONTEXPAND | VM_DONTDUMP;
+        vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+        if (io_remap_pfn_range(vma, vma->vm_start, dtsled.dr_phys >> PAGE_SHIFT,
+                               PAGE_SIZE, vma->vm_page_prot)) {
+            return -EAGAIN;
+        }
+    }
+
+    vma->vm_ops = &dtsled_vm_ops;
+    dtsled_vma_open(vma);
+    return 0;
+}
+
+static long dtsled_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct led_stream_cfg cfg;
+    struct led_gpio_setclr sc;
+    struct led_mmio_stats st;
+    int ret = 0;
+
+    switch (cmd)
+    {
+    case LED_STREAM_CMD:
+        if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg))) {
+            return -EFAULT;
+        }
+        return stream_config(&cfg);
+    case LED_GPIO_SETCLR_CMD:
+        if (copy_from_user(&sc, (void __user *)arg, sizeof(sc))) {
+            return -EFAULT;
+        }
+        ret = led_pm_get();
+        if (ret) {
+            return ret;
+        }
+        gpio1_setclr(sc.set, sc.clr);
+        led_pm_put();
+        return 0;
+    case LED_MMIO_STATS_CMD:
+        led_mmio_stats(&st);
+        if (copy_to_user((void __user *)arg, &st, sizeof(st))) {
+            return -EFAULT;
+        }
+        return 0;
+    default:
+        return -ENOTTY;
     }
 }
 
@@ -57,28 +684,38 @@ static void init_led_gpio(void)
     u32 val = 0;
 
     /* 使能GPIO1时钟 */
-    val = readl(CCM_CCGR1);
-    val |= (0b11 << 26);    // bit 26 27 set 1
-    writel(val, CCM_CCGR1);
+    val = led_readl(CCM_CCGR1);
+    val |= CCGR1_GPIO1_CG;  // bit 26 27 set 1
+    led_writel(val, CCM_CCGR1);
 
     /* 设置 GPIO1_IO03 复用功能 */
-    writel(0b101, SW_MUX_GPIO1_IO03);
+    led_writel(0b101, SW_MUX_GPIO1_IO03);
 
     /* 设置IO属性 */
-    writel(0x10B0, SW_PAD_GPIO1_IO03);
+    led_writel(0x10B0, SW_PAD_GPIO1_IO03);
 
     /* 设置GPIO1_IO03为输出 */
-    val = readl(GPIO1_GDIR);
+    val = led_readl(GPIO1_GDIR);
     val |= (1 << 3);
-    writel(val, GPIO1_GDIR);
+    led_writel(val, GPIO1_GDIR);
 
     /* 熄灭灯 */
+    gpio1_dr_sync();
     led_switch(LEDOFF);
 }
 
 static int dtsled_open(struct inode *inode, struct file *filp)
 {
+    int ret = 0;
+
     filp->private_data = &dtsled;
+    /* 打开时同步一次，翻转路径不再读寄存器 */
+    ret = led_pm_get();
+    if (ret) {
+        return ret;
+    }
+    gpio1_dr_sync();
+    led_pm_put();
     return 0;
 }
 
@@ -96,17 +733,32 @@ static ssize_t dtsled_write(struct file *filp, const char __user *buf,
     int ret = 0;
     uint8_t data[1];
 
-    ret = copy_from_user(data, buf, cnt);
-    if (ret < 0) {
-        printk("kernel write failed.\n");
+    if (dtsled.stream_format == STREAM_BURST || dtsled.stream_format == STREAM_BURST_STRICT) {
+        return burst_write(buf, cnt);
+    }
+    if (dtsled.stream_format != STREAM_OFF) {
+        return stream_write(filp, buf, cnt);
+    }
+
+    ret = copy_from_user(data, buf, sizeof(data));
+    if (ret != 0) {
+        atomic_long_inc(&dtsled.errors.fault);
+        dev_dbg_ratelimited(dtsled.device, "kernel write failed.\n");
         return -1;
     }
 
     if ((data[0] != LEDON) && (data[0] != LEDOFF)) {
-        printk("param out of range.\n");
+        atomic_long_inc(&dtsled.errors.inval);
+        dev_dbg_ratelimited(dtsled.device, "param out of range.\n");
         return -1;
     }
+
+    ret = led_pm_get();
+    if (ret) {
+        return ret;
+    }
     led_switch(data[0]);
+    led_pm_put();
 
     return 0;
 }
@@ -123,84 +775,95 @@ static struct file_operations dtsled_fops = {
     .open = dtsled_open, 
     .read = dtsled_read, 
     .write = dtsled_write, 
+    .unlocked_ioctl = dtsled_ioctl,
+    .mmap = dtsled_mmap,
     .release = dtsled_release, 
 };
 
-static int __init dtsled_init(void)
+static void dtsled_unmap_pages(void)
 {
-    int ret = 0;
-    const char *str = NULL;
-    // u8 reg_count = 0;
-// #define reg_data_size 10
-    // u32 reg_data[reg_data_size] = { 0 };
-    // u8 i = 0;
+    while (dtsled.nr_reg_pages > 0) {
+        iounmap(dtsled.reg_pages[--dtsled.nr_reg_pages]);
+    }
+}
 
-    /* 注册字符设备 */
-    /* 1. 申请设备号 */
-    dtsled.major = 0;   /* 设备号由内核分配 */
-    if (dtsled.major) { /* 定义了设备号 */
-        dtsled.devid = MKDEV(dtsled.major, 0);
-        ret = register_chrdev_region(dtsled.devid, DTSLED_CNT, DTSLED_NAME);
-        if (ret < 0) {
-            printk("register_chrdev_region failed.\n");
-            goto fail_devid;
+/*
+ * 按页映射 reg 中的寄存器，同一页内的寄存器共用一次 ioremap，
+ * 五个寄存器只占三页，省下 vmalloc 空间与 TLB 项。
+ */
+static int dtsled_map_regs(struct device_node *nd)
+{
+    void __iomem **regs[DTSLED_REG_CNT] = {
+        &CCM_CCGR1, &SW_MUX_GPIO1_IO03, &SW_PAD_GPIO1_IO03, &GPIO1_GDIR, &GPIO1_DR,
+    };
+    phys_addr_t page_phys[DTSLED_REG_CNT];
+    struct resource res;
+    phys_addr_t base = 0;
+    int i = 0;
+    int j = 0;
+
+    for (i = 0; i < DTSLED_REG_CNT; i++) {
+        if (of_address_to_resource(nd, i, &res) < 0) {
+            goto fail_map;
         }
-    } else {    /* 没有给定设备号 */
-        ret = alloc_chrdev_region(&dtsled.devid, 0, DTSLED_CNT, DTSLED_NAME);
-        if (ret < 0) {
-            printk("alloc_chrdev_region failed.\n");
-            goto fail_devid;
+        base = res.start & PAGE_MASK;
+        if (res.end >= base + PAGE_SIZE) {  /* 跨页的寄存器不支持 */
+            printk("reg %d crosses a page boundary.\n", i);
+            goto fail_map;
         }
-        dtsled.major = MAJOR(dtsled.devid);
-        dtsled.minor = MINOR(dtsled.devid);
-    }
 
-    /* 2. 添加字符设备 */
-    dtsled.cdev.owner = THIS_MODULE;
-    cdev_init(&dtsled.cdev, &dtsled_fops);
-    ret = cdev_add(&dtsled.cdev, dtsled.devid, DTSLED_CNT);
-    if (ret < 0) {
-        printk("cdev_add failed.\n");
-        goto fail_cdev;
+        for (j = 0; j < dtsled.nr_reg_pages; j++) {
+            if (page_phys[j] == base) {
+                break;
+            }
+        }
+        if (j == dtsled.nr_reg_pages) {
+            dtsled.reg_pages[j] = ioremap(base, PAGE_SIZE);
+            if (!dtsled.reg_pages[j]) {
+                goto fail_map;
+            }
+            page_phys[j] = base;
+            dtsled.nr_reg_pages++;
+        }
+        *regs[i] = dtsled.reg_pages[j] + (res.start - base);
     }
+    printk("dtsled: %d regs in %d pages\n", DTSLED_REG_CNT, dtsled.nr_reg_pages);
 
-    /* 3. 自动创建设备节点 */
-    /* 创建类 */
-    dtsled.class = class_create(THIS_MODULE, DTSLED_NAME);
-    if (IS_ERR(dtsled.class)) {
-        ret = PTR_ERR(dtsled.class);
-        printk("class_create failed.\n");
-        goto fail_class;
-    }
+    return 0;
 
-    /* 创建设备 */
-    dtsled.device = device_create(dtsled.class, NULL, dtsled.devid, NULL, DTSLED_NAME);
-    if (IS_ERR(dtsled.device)) {
-        ret = PTR_ERR(dtsled.device);
-        printk("device_create failed.\n");
-        goto fail_device;
-    }
+fail_map:
+    dtsled_unmap_pages();
+    return -EINVAL;
+}
+
+/* 从设备树获取寄存器地址并映射 */
+static int dtsled_map_dt(void)
+{
+    int ret = 0;
+    const char *str = NULL;
+    struct resource res;
+    // u8 reg_count = 0;
+// #define reg_data_size 10
+    // u32 reg_data[reg_data_size] = { 0 };
+    // u8 i = 0;
 
     /* 获取设备树属性内容 */
     dtsled.nd = of_find_node_by_path("/alphaled");
     if (dtsled.nd == NULL) {    /* 失败 */
-        ret = -EINVAL;
-        goto fail_finddts;
+        return -EINVAL;
     }
 
     /* 读字符串 status */
     ret = of_property_read_string(dtsled.nd, "status", &str);
     if (ret < 0) {
-        ret = -EINVAL;
-        goto fail_finddts;
+        return -EINVAL;
     }
     printk("status = %s\n", str);
 
     /* 读字符串 compatible */
     ret = of_property_read_string(dtsled.nd, "compatible", &str);
     if (ret < 0) {
-        ret = -EINVAL;
-        goto fail_finddts;
+        return -EINVAL;
     }
     printk("compatible = %s\n", str);
 
@@ -208,20 +871,17 @@ static int __init dtsled_init(void)
     /* 读数组 reg */
     reg_count = of_property_count_elems_of_size(dtsled.nd, "reg", sizeof(u32));
     if (reg_count < 0) {
-        ret = -EINVAL;
-        goto fail_finddts;
+        return -EINVAL;
     }
     printk("reg count = %d\n", reg_count);
     if (reg_count != reg_data_size) {
         printk("error: reg count must be %d!\n", reg_data_size);
-        ret = -EINVAL;
-        goto fail_finddts;
+        return -EINVAL;
     }
  
     ret = of_property_read_u32_array(dtsled.nd, "reg", reg_data, reg_count);
     if (ret < 0) {
-        ret = -EINVAL;
-        goto fail_finddts;
+        return -EINVAL;
     }
     printk("reg data = ");
     for (i = 0; i < reg_count; i++) {
@@ -230,6 +890,16 @@ static int __init dtsled_init(void)
     printk("\n");
 #endif
 
+    /* mmap 用到的物理地址与授权引脚 */
+    ret = of_address_to_resource(dtsled.nd, 4, &res);
+    if (ret < 0) {
+        return -EINVAL;
+    }
+    dtsled.dr_phys = res.start & PAGE_MASK;
+    if (of_property_read_u32(dtsled.nd, "grant-mask", &dtsled.grant_mask) < 0) {
+        dtsled.grant_mask = LED_PIN_MASK;
+    }
+
     /* LED 初始化 */
     /* 寄存器地址映射 */
 #if 0
@@ -239,18 +909,122 @@ static int __init dtsled_init(void)
     GPIO1_GDIR = ioremap(reg_data[6], reg_data[7]);
     GPIO1_DR = ioremap(reg_data[8], reg_data[9]);
 #endif
+#if 0
     CCM_CCGR1 = of_iomap(dtsled.nd, 0);
     SW_MUX_GPIO1_IO03 = of_iomap(dtsled.nd, 1);
     SW_PAD_GPIO1_IO03 = of_iomap(dtsled.nd, 2);
     GPIO1_GDIR = of_iomap(dtsled.nd, 3);
     GPIO1_DR = of_iomap(dtsled.nd, 4);
+#endif
+    return dtsled_map_regs(dtsled.nd);
+}
+
+/* 模拟寄存器，不依赖设备树，三页分别对应 CCM、IOMUXC 与 GPIO1 */
+static int dtsled_map_sim(void)
+{
+    sim_regs = vmalloc_user(SIM_PAGES * PAGE_SIZE);
+    if (!sim_regs) {
+        return -ENOMEM;
+    }
+
+    CCM_CCGR1 = SIM_REG(SIM_PAGE_CCM, SIM_CCM_CCGR1_OFF);
+    SW_MUX_GPIO1_IO03 = SIM_REG(SIM_PAGE_IOMUXC, SIM_SW_MUX_GPIO1_IO03_OFF);
+    SW_PAD_GPIO1_IO03 = SIM_REG(SIM_PAGE_IOMUXC, SIM_SW_PAD_GPIO1_IO03_OFF);
+    GPIO1_GDIR = SIM_REG(SIM_PAGE_GPIO1, SIM_GPIO1_GDIR_OFF);
+    GPIO1_DR = SIM_REG(SIM_PAGE_GPIO1, SIM_GPIO1_DR_OFF);
+    dtsled.grant_mask = LED_PIN_MASK;
+    printk("dtsled: using simulated registers\n");
+
+    return 0;
+}
+
+static void dtsled_unmap(void)
+{
+    if (sim) {
+        vfree(sim_regs);
+        return;
+    }
+
+    dtsled_unmap_pages();
+}
+
+static int __init dtsled_init(void)
+{
+    int ret = 0;
+
+    spin_lock_init(&dtsled.lock);
+    spin_lock_init(&dtsled.pm.lock);
+    INIT_KFIFO(dtsled.stream_fifo);
+    init_waitqueue_head(&dtsled.stream_wq);
+    mutex_init(&dtsled.stream_mutex);
+    hrtimer_init(&dtsled.stream_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    dtsled.stream_timer.function = stream_timer_func;
+
+    /* 注册字符设备 */
+    /* 1. 申请设备号 */
+    dtsled.major = 0;   /* 设备号由内核分配 */
+    if (dtsled.major) { /* 定义了设备号 */
+        dtsled.devid = MKDEV(dtsled.major, 0);
+        ret = register_chrdev_region(dtsled.devid, DTSLED_CNT, DTSLED_NAME);
+        if (ret < 0) {
+            printk("register_chrdev_region failed.\n");
+            goto fail_devid;
+        }
+    } else {    /* 没有给定设备号 */
+        ret = alloc_chrdev_region(&dtsled.devid, 0, DTSLED_CNT, DTSLED_NAME);
+        if (ret < 0) {
+            printk("alloc_chrdev_region failed.\n");
+            goto fail_devid;
+        }
+        dtsled.major = MAJOR(dtsled.devid);
+        dtsled.minor = MINOR(dtsled.devid);
+    }
+
+    /* 2. 自动创建设备节点 */
+    /* 创建类 */
+    dtsled.class = class_create(THIS_MODULE, DTSLED_NAME);
+    if (IS_ERR(dtsled.class)) {
+        ret = PTR_ERR(dtsled.class);
+        printk("class_create failed.\n");
+        goto fail_class;
+    }
+    dtsled.class->pm = &dtsled_pm_ops;
+
+    /* 创建设备 */
+    dtsled.device = device_create_with_groups(dtsled.class, NULL, dtsled.devid, &dtsled.errors,
+                                              dtsled_groups, DTSLED_NAME);
+    if (IS_ERR(dtsled.device)) {
+        ret = PTR_ERR(dtsled.device);
+        printk("device_create failed.\n");
+        goto fail_device;
+    }
+
+    /* 寄存器地址映射 */
+    ret = sim ? dtsled_map_sim() : dtsled_map_dt();
+    if (ret < 0) {
+        goto fail_finddts;
+    }
 
     /* 初始化 led gpio */
     init_led_gpio();
+    led_pm_enable(dtsled.device);
+
+    /* 3. 添加字符设备，open 会用到映射、device 与运行时 PM，放在最后 */
+    dtsled.cdev.owner = THIS_MODULE;
+    cdev_init(&dtsled.cdev, &dtsled_fops);
+    ret = cdev_add(&dtsled.cdev, dtsled.devid, DTSLED_CNT);
+    if (ret < 0) {
+        printk("cdev_add failed.\n");
+        goto fail_cdev;
+    }
     printk("dtsled init success.\n");
 
     return 0;
 
+fail_cdev:
+    led_pm_disable(dtsled.device);
+    /* 释放映射 */
+    dtsled_unmap();
 fail_finddts:
     /* 销毁设备 */
     device_destroy(dtsled.class, dtsled.devid);
@@ -258,23 +1032,23 @@ fail_device:
     /* 销毁类 */
     class_destroy(dtsled.class);
 fail_class:
-    /* 删除字符设备 */
-    cdev_del(&dtsled.cdev);
-fail_cdev:
     /* 释放设备号 */
     unregister_chrdev_region(dtsled.devid, DTSLED_CNT);
 fail_devid:
     return ret;
 }
 
+/* 与初始化相反的顺序，先删除字符设备，之后不会再有新的 open */
 static void __exit dtsled_exit(void)
 {
+    /* 删除字符设备 */
+    cdev_del(&dtsled.cdev);
+
+    stream_stop();
+    led_pm_disable(dtsled.device);
+
     /* 释放映射 */
-    iounmap(CCM_CCGR1);
-    iounmap(SW_MUX_GPIO1_IO03);
-    iounmap(SW_PAD_GPIO1_IO03);
-    iounmap(GPIO1_GDIR);
-    iounmap(GPIO1_DR);
+    dtsled_unmap();
 
     /* 销毁设备 */
     device_destroy(dtsled.class, dtsled.devid);
@@ -282,9 +1056,6 @@ static void __exit dtsled_exit(void)
     /* 销毁类 */
     class_destroy(dtsled.class);
 
-    /* 删除字符设备 */
-    cdev_del(&dtsled.cdev);
-
     /* 释放设备号 */
     unregister_chrdev_region(dtsled.devid, DTSLED_CNT);
 }
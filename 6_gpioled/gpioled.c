@@ -12,185 +12,598 @@
 #include <linux/slab.h>
 #include <linux/gpio.h>
 #include <linux/of_gpio.h>
+#include <linux/platform_device.h>
+#include <linux/idr.h>
+#include <linux/gpio/consumer.h>
+#include <linux/version.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/leds.h>
+#include <linux/mutex.h>
+#include <linux/kref.h>
+
+#include "../common/fop_stats.h"
+#include "../common/led_pwm.h"
+#include "../common/err_stats.h"
+
+#define CREATE_TRACE_POINTS
+#include "gpioled_trace.h"
 
-#define GPIOLED_CNT 1
 #define GPIOLED_NAME "gpioled"
+#define GPIOLED_MINORS (MINORMASK + 1)  /* 动态主设备号下的全部 minor，实例数不设上限 */
+
+#define GPIOLED_MAX_LEDS 32    /* 写入位图为 u32 */
 
 #define LEDOFF 0
 #define LEDON 1
 
-/* gpioled设备结构体 */
+#if 0
+/*
+ * 每个节点一个实例，设备名取 label，没有 label 时为 gpioledN。
+ * 极性由 led-gpios 的标志决定。
+ */
+gpioled-status {
+    compatible = "alientek,gpioled";
+    pinctrl-names = "default";
+    pinctrl-0 = <&pinctrl_led>;
+    label = "status";
+    led-gpios = <&gpio1 3 GPIO_ACTIVE_LOW>;
+    linux,default-trigger = "heartbeat";
+    status = "okay";
+};
+#endif
+
+/* 4.3 之前的内核里 gpiod_set_array_value 叫 gpiod_set_array */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 3, 0)
+#define gpiod_set_array_value gpiod_set_array
+#endif
+
+static bool per_line;
+module_param(per_line, bool, 0644);
+MODULE_PARM_DESC(per_line, "set lines one gpiod_set_value at a time instead of one gpiod_set_array_value (for comparison)");
+
+/*
+ * gpioled设备结构体，每个设备树节点一个。
+ * probe 与每个打开的文件各持一份引用，remove 之后已打开的文件仍可安全访问，最后一个引用释放实例
+ */
 struct gpioled_dev {
+    struct kref ref;
+    struct mutex lock;      /* 串行化写、ioctl 与 remove，也串行化 pwm_config/pwm_fade */
+    bool gone;              /* remove 之后为真，文件操作返回 -ENODEV，GPIO 已交还 devm */
     dev_t devid;
-    int major;
     int minor;
-    struct cdev cdev;       /* 字符设备 */
-    struct class *class;    /* 类 */
+    char name[32];
+    struct cdev *cdev;      /* cdev_alloc 分配，打开的文件持有其引用，最后一次 fput 时释放 */
     struct device *device;  /* 设备 */
-    struct device_node *nd; /* 设备节点 */
-    int led_gpio;
+    struct gpio_desc *leds[GPIOLED_MAX_LEDS];  /* led-gpios 中的全部灯，极性由设备树标志决定 */
+    int nr_leds;
+    struct led_pwm pwm;     /* 软件 PWM 亮度与渐变 */
+    struct led_classdev led;    /* LED 子系统接口，内核触发器直接驱动 */
+    struct hrtimer blink_timer; /* blink_set 交给这里，用户进程退出后继续闪烁 */
+    spinlock_t blink_lock;
+    u32 blink_gen;          /* 每次停止或重新设置闪烁加一 */
+    u32 blink_timer_gen;    /* 最近一次启动定时器时的 blink_gen */
+    bool blink_on;
+    u64 blink_on_ns;
+    u64 blink_off_ns;
+    struct err_stats errors;
 };
 
-struct gpioled_dev gpioled;
+/* 所有实例共享的主设备号与类，minor 由 IDR 分配，open 经它由 minor 找回实例 */
+static dev_t gpioled_devid;
+static int gpioled_major;
+static struct class *gpioled_class;
+static const struct file_operations *gpioled_cdev_fops;   /* 套上统计层后的 gpioled_fops */
+static DEFINE_IDR(gpioled_idr);
+static DEFINE_MUTEX(gpioled_idr_lock);  /* 保护 gpioled_idr 与 open 取引用 */
+
+static void gpioled_free(struct kref *ref)
+{
+    kfree(container_of(ref, struct gpioled_dev, ref));
+}
+
+/*
+ * 按位图设置全部灯，bit i 对应 led-gpios 的第 i 项，1 为点亮。
+ * gpiod_set_array_value 把同一控制器上的线合并，控制器支持 set_multiple 时
+ * 每个 bank 只写一次寄存器。
+ */
+static void gpioled_set_mask(struct gpioled_dev *dev, u32 mask)
+{
+    int values[GPIOLED_MAX_LEDS];
+    int i = 0;
+
+    trace_gpioled_set(dev->name, mask, dev->nr_leds);
+    if (per_line) {
+        for (i = 0; i < dev->nr_leds; i++) {
+            gpiod_set_value(dev->leds[i], !!(mask & BIT(i)));
+        }
+        return;
+    }
+
+    for (i = 0; i < dev->nr_leds; i++) {
+        values[i] = !!(mask & BIT(i));
+    }
+    gpiod_set_array_value(dev->nr_leds, dev->leds, values);
+}
+
+static void gpioled_set_level(struct gpioled_dev *dev, bool on)
+{
+    gpioled_set_mask(dev, on ? GENMASK(dev->nr_leds - 1, 0) : 0);
+}
+
+static void gpioled_pwm_output(struct led_pwm *pwm, bool on)
+{
+    gpioled_set_level(container_of(pwm, struct gpioled_dev, pwm), on);
+}
+
+static enum hrtimer_restart gpioled_blink_func(struct hrtimer *timer)
+{
+    struct gpioled_dev *dev = container_of(timer, struct gpioled_dev, blink_timer);
+
+    spin_lock(&dev->blink_lock);
+    /*
+     * 停止后 blink_gen 已变；停止后又重新设置时定时器已被 hrtimer_start 重新入队。
+     * 两种情况下这次回调都已过期，不能再推进到期时间或重启，否则同一定时器入队两次
+     */
+    if (dev->blink_timer_gen != dev->blink_gen || hrtimer_is_queued(timer)) {
+        spin_unlock(&dev->blink_lock);
+        return HRTIMER_NORESTART;
+    }
+    dev->blink_on = !dev->blink_on;
+    gpioled_set_level(dev, dev->blink_on);
+    hrtimer_add_expires_ns(timer, dev->blink_on ? dev->blink_on_ns : dev->blink_off_ns);
+    spin_unlock(&dev->blink_lock);
+
+    return HRTIMER_RESTART;
+}
+
+/*
+ * 停止闪烁，返回后回调不会再改电平，sync 为假时可在原子上下文调用。
+ * sync 为真时还等待正在运行的回调结束，只在进程上下文使用
+ */
+static void gpioled_blink_stop(struct gpioled_dev *dev, bool sync)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&dev->blink_lock, flags);
+    dev->blink_gen++;
+    spin_unlock_irqrestore(&dev->blink_lock, flags);
+    if (sync) {
+        hrtimer_cancel(&dev->blink_timer);
+    } else {
+        hrtimer_try_to_cancel(&dev->blink_timer);
+    }
+}
+
+/* timer 触发器优先调用这里，闪烁由驱动的 hrtimer 完成，LED 核心不再跑软件定时器 */
+static int gpioled_blink_set(struct led_classdev *led, unsigned long *delay_on,
+                           unsigned long *delay_off)
+{
+    struct gpioled_dev *dev = container_of(led, struct gpioled_dev, led);
+    unsigned long flags;
+
+    /* PWM 开启时返回错误，LED 核心改用软件闪烁，经 brightness_set 按亮度输出 */
+    if (dev->pwm.enabled) {
+        return -EINVAL;
+    }
+    if (*delay_on == 0 && *delay_off == 0) {
+        *delay_on = 500;    /* LED 核心约定的默认周期 */
+        *delay_off = 500;
+    }
+
+    gpioled_blink_stop(dev, false);
+    spin_lock_irqsave(&dev->blink_lock, flags);
+    dev->blink_on = (*delay_on != 0);
+    gpioled_set_level(dev, dev->blink_on);
+    if (*delay_on && *delay_off) {
+        dev->blink_on_ns = (u64)*delay_on * NSEC_PER_MSEC;
+        dev->blink_off_ns = (u64)*delay_off * NSEC_PER_MSEC;
+        dev->blink_timer_gen = dev->blink_gen;
+        hrtimer_start(&dev->blink_timer, ns_to_ktime(dev->blink_on_ns), HRTIMER_MODE_REL);
+    }
+    spin_unlock_irqrestore(&dev->blink_lock, flags);
+
+    return 0;
+}
+
+/* 可能在触发器的软中断或定时器上下文中调用，不能睡眠 */
+static void gpioled_brightness_set(struct led_classdev *led, enum led_brightness value)
+{
+    struct gpioled_dev *dev = container_of(led, struct gpioled_dev, led);
+    struct led_fade fade = { value, 0, FADE_LINEAR };
+
+    gpioled_blink_stop(dev, false);
+    /* PWM 开启时按亮度输出，否则只有亮灭 */
+    if (pwm_fade(&dev->pwm, &fade) < 0) {
+        gpioled_set_level(dev, value != LED_OFF);
+    }
+}
 
 static int gpioled_open(struct inode *inode, struct file *filp)
 {
-    filp->private_data = &gpioled;
+    struct gpioled_dev *dev = NULL;
+
+    /* probe 完成前表项为 NULL，remove 开始后 gone 为真，两种情况都不再打开 */
+    mutex_lock(&gpioled_idr_lock);
+    dev = idr_find(&gpioled_idr, iminor(inode));
+    if (dev && !dev->gone) {
+        kref_get(&dev->ref);
+    } else {
+        dev = NULL;
+    }
+    mutex_unlock(&gpioled_idr_lock);
+    if (dev == NULL) {
+        return -ENODEV;
+    }
+
+    filp->private_data = dev;
     return 0;
 }
 
 static ssize_t gpioled_read(struct file *filp, char __user *buf,     
                                size_t cnt, loff_t *offt)
 {
-    return 0;
+    struct gpioled_dev *dev = filp->private_data;
+
+    return dev->gone ? -ENODEV : 0;
 }
 
-static ssize_t gpioled_write(struct file *filp, const char __user *buf,  
+static ssize_t gpioled_do_write(struct file *filp, const char __user *buf,
                                 size_t cnt, loff_t *offt)
 {
+    struct gpioled_dev *dev = filp->private_data;
     int ret = 0;
     uint8_t data[1];
+    u32 mask = 0;
 
-    ret = copy_from_user(data, buf, cnt);
-    if (ret < 0) {
-        printk("kernel write failed.\n");
-        return -1;
+    /* 4 字节为位图，一次设置全部灯 */
+    if (cnt == sizeof(mask)) {
+        if (copy_from_user(&mask, buf, sizeof(mask))) {
+            atomic_long_inc(&dev->errors.fault);
+            return -EFAULT;
+        }
+        if (dev->pwm.enabled) {
+            atomic_long_inc(&dev->errors.busy);
+            return -EBUSY;
+        }
+        gpioled_blink_stop(dev, true);
+        gpioled_set_mask(dev, mask);
+        return sizeof(mask);
+    }
+
+    ret = copy_from_user(data, buf, sizeof(data));
+    if (ret != 0) {
+        atomic_long_inc(&dev->errors.fault);
+        dev_dbg_ratelimited(dev->device, "kernel write failed.\n");
+        return -EFAULT;
+    }
+
+    if (data[0] == LEDON || data[0] == LEDOFF) {
+        gpioled_blink_stop(dev, true);  /* 用户写入优先于触发器的闪烁 */
+    }
+    if (dev->pwm.enabled && (data[0] == LEDON || data[0] == LEDOFF)) {
+        return pwm_switch(&dev->pwm, data[0] == LEDON);
     }
 
     if (data[0] == LEDON) {
-        gpio_set_value(gpioled.led_gpio, 0);
+        gpioled_set_level(dev, true);
     } else if (data[0] == LEDOFF) {
-        gpio_set_value(gpioled.led_gpio, 1);
+        gpioled_set_level(dev, false);
     } else {
-        printk("param out of range.\n");
-        return -1;
+        atomic_long_inc(&dev->errors.inval);
+        dev_dbg_ratelimited(dev->device, "param out of range.\n");
+        return -EINVAL;
     }
     
     return 0;
 }
 
+static ssize_t gpioled_write(struct file *filp, const char __user *buf,  
+                                size_t cnt, loff_t *offt)
+{
+    struct gpioled_dev *dev = filp->private_data;
+    ssize_t ret = 0;
+
+    trace_gpioled_write_enter(dev->name, cnt);
+    mutex_lock(&dev->lock);
+    ret = dev->gone ? -ENODEV : gpioled_do_write(filp, buf, cnt, offt);
+    mutex_unlock(&dev->lock);
+    trace_gpioled_write_exit(dev->name, ret);
+
+    return ret;
+}
+
 static int gpioled_release(struct inode *inode, struct file *filp)
 {
+    struct gpioled_dev *dev = filp->private_data;
+
+    kref_put(&dev->ref, gpioled_free);
     return 0;
 }
 
+static long gpioled_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct gpioled_dev *dev = filp->private_data;
+    struct led_pwm_cfg cfg;
+    struct led_fade fade;
+    struct led_pwm_stats st;
+    long ret = 0;
+
+    mutex_lock(&dev->lock);
+    if (dev->gone) {
+        mutex_unlock(&dev->lock);
+        return -ENODEV;
+    }
+
+    switch (cmd)
+    {
+    case LED_PWM_CMD:
+        if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg))) {
+            ret = -EFAULT;
+            break;
+        }
+        ret = pwm_config(&dev->pwm, &cfg);
+        break;
+    case LED_FADE_CMD:
+        if (copy_from_user(&fade, (void __user *)arg, sizeof(fade))) {
+            ret = -EFAULT;
+            break;
+        }
+        ret = pwm_fade(&dev->pwm, &fade);
+        break;
+    case LED_PWM_STATS_CMD:
+        pwm_get_stats(&dev->pwm, &st);
+        if (copy_to_user((void __user *)arg, &st, sizeof(st))) {
+            ret = -EFAULT;
+        }
+        break;
+    default:
+        ret = -ENOTTY;
+        break;
+    }
+    mutex_unlock(&dev->lock);
+
+    return ret;
+}
+
 /* 字符设备操作集合 */
 static struct file_operations gpioled_fops = { 
     .owner = THIS_MODULE,
     .open = gpioled_open, 
     .read = gpioled_read, 
     .write = gpioled_write, 
+    .unlocked_ioctl = gpioled_ioctl,
     .release = gpioled_release, 
 };
 
-static int __init led_init(void)
+static const struct attribute_group *gpioled_groups[] = {
+    &err_stats_group,
+    NULL,
+};
+
+/*
+ * 每个匹配的设备树节点一个实例。GPIO 用 devm 管理；实例用 kref 计数，不用 devm，
+ * 解绑时仍打开着的文件还会访问它。cdev、设备节点和 LED classdev 在 remove 中按相反顺序释放。
+ */
+static int gpioled_probe(struct platform_device *pdev)
 {
+    struct device_node *np = pdev->dev.of_node;
+    struct gpioled_dev *dev = NULL;
+    const char *label = NULL;
     int ret = 0;
-    /* 注册设备号 */
-    ret = alloc_chrdev_region(&gpioled.devid, 0, GPIOLED_CNT, GPIOLED_NAME);
-    if (ret < 0) {
-        printk("alloc_chrdev_region failed.\n");
-        goto fail_devid;
+    int i = 0;
+
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if (dev == NULL) {
+        return -ENOMEM;
     }
-    gpioled.major = MAJOR(gpioled.devid);
-    gpioled.minor = MINOR(gpioled.devid);
-    printk("gpioled major = %d, minor = %d\n", gpioled.major, gpioled.minor);
+    kref_init(&dev->ref);
 
-    /* 添加字符设备 */
-    gpioled.cdev.owner = THIS_MODULE;
-    cdev_init(&gpioled.cdev, &gpioled_fops);
-    ret = cdev_add(&gpioled.cdev, gpioled.devid, GPIOLED_CNT);
-    if (ret < 0) {
-        printk("cdev_add failed.\n");
-        goto fail_cdev;
+    /* 获取LED所对应的GPIO，led-gpios 可以列出多个 */
+    dev->nr_leds = of_gpio_named_count(np, "led-gpios");
+    if (dev->nr_leds <= 0 || dev->nr_leds > GPIOLED_MAX_LEDS) {
+        dev_err(&pdev->dev, "can't find led gpio\n");
+        ret = -EINVAL;
+        goto fail_gpio;
     }
 
-    /* 创建类 */
-    gpioled.class = class_create(THIS_MODULE, GPIOLED_NAME);
-    if (IS_ERR(gpioled.class)) {
-        ret = PTR_ERR(gpioled.class);
-        printk("class_create failed.\n");
-        goto fail_class;
+    /* 申请IO并设置为输出，初始熄灭 */
+    for (i = 0; i < dev->nr_leds; i++) {
+        dev->leds[i] = devm_gpiod_get_index(&pdev->dev, "led", i, GPIOD_OUT_LOW);
+        if (IS_ERR(dev->leds[i])) {
+            ret = PTR_ERR(dev->leds[i]);
+            if (ret != -EPROBE_DEFER) {
+                dev_err(&pdev->dev, "gpiod_get_index %d failed.\n", i);
+            }
+            goto fail_gpio;
+        }
     }
 
-    /* 创建设备 */
-    gpioled.device = device_create(gpioled.class, NULL, gpioled.devid, NULL, GPIOLED_NAME);
-    if (IS_ERR(gpioled.device)) {
-        ret = PTR_ERR(gpioled.device);
-        printk("device_create failed.\n");
-        goto fail_device;
+    /* 先占住 minor，表项在 probe 成功后才指向实例 */
+    mutex_lock(&gpioled_idr_lock);
+    dev->minor = idr_alloc(&gpioled_idr, NULL, 0, GPIOLED_MINORS, GFP_KERNEL);
+    mutex_unlock(&gpioled_idr_lock);
+    if (dev->minor < 0) {
+        ret = dev->minor;
+        goto fail_gpio;
     }
 
-    /* 获取设备节点 */
-    gpioled.nd = of_find_node_by_path("/gpioled");
-    if (gpioled.nd == NULL) {
-        ret = -EINVAL;
-        goto fail_finddts;
+    /* 节点有 label 时用作设备名，否则按 minor 编号 */
+    if (of_property_read_string(np, "label", &label) == 0) {
+        strlcpy(dev->name, label, sizeof(dev->name));
+    } else {
+        snprintf(dev->name, sizeof(dev->name), GPIOLED_NAME "%d", dev->minor);
     }
+    dev->devid = MKDEV(gpioled_major, dev->minor);
 
-    /* 获取LED所对应的GPIO */
-    gpioled.led_gpio = of_get_named_gpio(gpioled.nd, "led-gpios", 0);
-    if (gpioled.led_gpio < 0) {
-        printk("can't find led gpio\n");
-        ret = -EINVAL;
-        goto fail_finddts;
+    pwm_init(&dev->pwm, gpioled_pwm_output);
+    mutex_init(&dev->lock);
+    spin_lock_init(&dev->blink_lock);
+    hrtimer_init(&dev->blink_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    dev->blink_timer.function = gpioled_blink_func;
+
+    /* 添加字符设备 */
+    dev->cdev = cdev_alloc();
+    if (dev->cdev == NULL) {
+        ret = -ENOMEM;
+        goto fail_cdev;
+    }
+    dev->cdev->ops = gpioled_cdev_fops;
+    dev->cdev->owner = THIS_MODULE;
+    ret = cdev_add(dev->cdev, dev->devid, 1);
+    if (ret < 0) {
+        dev_err(&pdev->dev, "cdev_add failed.\n");
+        kobject_put(&dev->cdev->kobj);
+        goto fail_cdev;
     }
-    printk("led gpio num = %d\n", gpioled.led_gpio);
 
-    /* 申请IO */
-    ret = gpio_request(gpioled.led_gpio, "led-gpio");
-    if (ret) {
-        printk("gpio_request failed.\n");
-        ret = -EINVAL;
-        goto fail_finddts;
+    /* 创建设备 */
+    dev->device = device_create_with_groups(gpioled_class, &pdev->dev, dev->devid, &dev->errors,
+                                            gpioled_groups, "%s", dev->name);
+    if (IS_ERR(dev->device)) {
+        ret = PTR_ERR(dev->device);
+        dev_err(&pdev->dev, "device_create failed.\n");
+        goto fail_device;
     }
 
-    /* 设置为输出 */
-    ret = gpio_direction_output(gpioled.led_gpio, 1);
-    if (ret) {
-        printk("gpio_direction_output failed.\n");
-        ret = -EINVAL;
-        goto fail_gpio_direction;
+    /* 注册到 LED 子系统，/sys/class/leds/<name> */
+    dev->led.name = dev->name;
+    dev->led.max_brightness = 255;
+    dev->led.brightness_set = gpioled_brightness_set;
+    dev->led.blink_set = gpioled_blink_set;
+    of_property_read_string(np, "linux,default-trigger", &dev->led.default_trigger);
+    ret = led_classdev_register(&pdev->dev, &dev->led);
+    if (ret < 0) {
+        dev_err(&pdev->dev, "led_classdev_register failed.\n");
+        goto fail_led;
     }
 
-    /* 输出低电平，点亮LED灯 */
-    gpio_set_value(gpioled.led_gpio, 0);
+    platform_set_drvdata(pdev, dev);
+    /* 此后 open 才能找到实例 */
+    mutex_lock(&gpioled_idr_lock);
+    idr_replace(&gpioled_idr, dev, dev->minor);
+    mutex_unlock(&gpioled_idr_lock);
+    dev_info(&pdev->dev, "%s: %d leds, minor %d\n", dev->name, dev->nr_leds, dev->minor);
 
     return 0;
 
-fail_gpio_direction:
-    /* 释放IO */
-    gpio_free(gpioled.led_gpio);
-fail_finddts:
+fail_led:
     /* 销毁设备 */
-    device_destroy(gpioled.class, gpioled.devid);
+    device_destroy(gpioled_class, dev->devid);
 fail_device:
-    /* 销毁类 */
-    class_destroy(gpioled.class);
-fail_class:
     /* 删除字符设备 */
-    cdev_del(&gpioled.cdev);
+    cdev_del(dev->cdev);
 fail_cdev:
+    mutex_lock(&gpioled_idr_lock);
+    idr_remove(&gpioled_idr, dev->minor);
+    mutex_unlock(&gpioled_idr_lock);
+fail_gpio:
+    /* 表项一直为 NULL，没有文件打开过，直接释放 */
+    kfree(dev);
+    return ret;
+}
+
+static int gpioled_remove(struct platform_device *pdev)
+{
+    struct gpioled_dev *dev = platform_get_drvdata(pdev);
+
+    /* 注销时 LED 核心会移除触发器并熄灭 */
+    led_classdev_unregister(&dev->led);
+
+    /* 等正在进行的写与 ioctl 结束，之后的文件操作返回 -ENODEV，不再碰 GPIO */
+    mutex_lock(&dev->lock);
+    dev->gone = true;
+    gpioled_blink_stop(dev, true);
+    pwm_stop(&dev->pwm);
+    /* 关灯，GPIO 在 remove 返回后由 devm 释放 */
+    gpioled_set_level(dev, false);
+    mutex_unlock(&dev->lock);
+
+    /* 销毁设备 */
+    device_destroy(gpioled_class, dev->devid);
+    /* 删除字符设备，已打开的文件仍持有 cdev 与实例的引用 */
+    cdev_del(dev->cdev);
+    mutex_lock(&gpioled_idr_lock);
+    idr_remove(&gpioled_idr, dev->minor);
+    mutex_unlock(&gpioled_idr_lock);
+    kref_put(&dev->ref, gpioled_free);
+
+    return 0;
+}
+
+static const struct of_device_id gpioled_of_match[] = {
+    { .compatible = "alientek,gpioled" },
+    { /* sentinel */ }
+};
+MODULE_DEVICE_TABLE(of, gpioled_of_match);
+
+static struct platform_driver gpioled_driver = {
+    .driver = {
+        .name = GPIOLED_NAME,
+        .of_match_table = gpioled_of_match,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
+        /* 各实例并行 probe，不拖慢启动 */
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+#endif
+    },
+    .probe = gpioled_probe,
+    .remove = gpioled_remove,
+};
+
+static int __init led_init(void)
+{
+    int ret = 0;
+    /* 注册设备号，所有实例共用一个主设备号 */
+    ret = alloc_chrdev_region(&gpioled_devid, 0, GPIOLED_MINORS, GPIOLED_NAME);
+    if (ret < 0) {
+        printk("alloc_chrdev_region failed.\n");
+        goto fail_devid;
+    }
+    gpioled_major = MAJOR(gpioled_devid);
+    printk("gpioled major = %d\n", gpioled_major);
+
+    /* 创建类 */
+    gpioled_class = class_create(THIS_MODULE, GPIOLED_NAME);
+    if (IS_ERR(gpioled_class)) {
+        ret = PTR_ERR(gpioled_class);
+        printk("class_create failed.\n");
+        goto fail_class;
+    }
+
+    /* 所有实例共用一套统计 */
+    gpioled_cdev_fops = fop_stats_init(GPIOLED_NAME, &gpioled_fops);
+
+    /* 注册平台驱动，每个匹配节点 probe 一次 */
+    ret = platform_driver_register(&gpioled_driver);
+    if (ret < 0) {
+        printk("platform_driver_register failed.\n");
+        goto fail_driver;
+    }
+
+    return 0;
+
+fail_driver:
+    fop_stats_exit();
+    /* 销毁类 */
+    class_destroy(gpioled_class);
+fail_class:
     /* 释放设备号 */
-    unregister_chrdev_region(gpioled.devid, GPIOLED_CNT);
+    unregister_chrdev_region(gpioled_devid, GPIOLED_MINORS);
 fail_devid:
     return ret;
 }
 
 static void __exit led_exit(void)
 {
-    /* 关灯 */
-    gpio_set_value(gpioled.led_gpio, 1);
-    /* 释放IO */
-    gpio_free(gpioled.led_gpio);
-    /* 销毁设备 */
-    device_destroy(gpioled.class, gpioled.devid);
+    /* 注销驱动时逐个 remove 全部实例 */
+    platform_driver_unregister(&gpioled_driver);
+    fop_stats_exit();
     /* 销毁类 */
-    class_destroy(gpioled.class);
-    /* 删除字符设备 */
-    cdev_del(&gpioled.cdev);
+    class_destroy(gpioled_class);
     /* 释放设备号 */
-    unregister_chrdev_region(gpioled.devid, GPIOLED_CNT);
+    unregister_chrdev_region(gpioled_devid, GPIOLED_MINORS);
+    idr_destroy(&gpioled_idr);
 }
 
 /* 模块入口与出口 */
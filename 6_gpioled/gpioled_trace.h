@@ -0,0 +1,64 @@
+/*
+ * gpioled 跟踪点，关闭时只是一条不跳转的指令。
+ * /sys/kernel/debug/tracing/events/drv_gpioled/ 或 trace/ 下的脚本
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM drv_gpioled
+
+#if !defined(_GPIOLED_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _GPIOLED_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(gpioled_write_enter,
+    TP_PROTO(const char *name, size_t cnt),
+    TP_ARGS(name, cnt),
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(size_t, cnt)
+    ),
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->cnt = cnt;
+    ),
+    TP_printk("%s cnt=%zu", __get_str(name), __entry->cnt)
+);
+
+TRACE_EVENT(gpioled_write_exit,
+    TP_PROTO(const char *name, ssize_t ret),
+    TP_ARGS(name, ret),
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->ret = ret;
+    ),
+    TP_printk("%s ret=%zd", __get_str(name), __entry->ret)
+);
+
+/* 每次改变输出，包括 PWM 边沿与闪烁 */
+TRACE_EVENT(gpioled_set,
+    TP_PROTO(const char *name, u32 mask, int nr_leds),
+    TP_ARGS(name, mask, nr_leds),
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(u32, mask)
+        __field(int, nr_leds)
+    ),
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->mask = mask;
+        __entry->nr_leds = nr_leds;
+    ),
+    TP_printk("%s mask=%#x nr_leds=%d", __get_str(name), __entry->mask, __entry->nr_leds)
+);
+
+#endif /* _GPIOLED_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE gpioled_trace
+#include <trace/define_trace.h>
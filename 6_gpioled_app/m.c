@@ -0,0 +1,329 @@
+#include "stdio.h"
+#include "unistd.h"
+#include "sys/types.h"
+#include "sys/stat.h"
+#include "fcntl.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "sys/time.h"
+#include "sys/resource.h"
+#include "sys/sysmacros.h"
+
+/*
+闪烁的 CPU 开销对比，CSV 输出
+./gpioled_app <dev> <led> <hz> <seconds>
+    dev  字符设备，如 /dev/gpioled0、/dev/beep
+    led  /sys/class/leds 下的名字，如 gpioled0、beep
+user 模式由本进程按 hz 循环 write 亮灭，trigger 模式只设置 timer 触发器后睡眠，
+闪烁由内核完成。proc_cpu_ms 为本进程消耗的 CPU，sys_busy_pct 为整机非空闲比例。
+
+多线更新对比
+./gpioled_app setbench <dev> <count>
+    向 dev 交替写全 1/全 0 位图 count 次，分别用 gpiod_set_array_value 与
+    逐线 gpiod_set_value(通过 gpioled 的 per_line 参数切换)，输出每秒更新次数
+
+非法写入吞吐
+./gpioled_app badbench <dev> <count>
+    向 dev 连续写 count 次超出范围的字节，输出每秒写入次数，前后各打印一次
+    /sys/dev/char/<major>:<minor>/errors。旧驱动每次都 printk，串口控制台下
+    吞吐受限于打印，改为计数后只剩系统调用本身的开销。适用于 led、dtsled、
+    gpioled、beep 等一字节协议的设备
+*/
+
+#define LEDOFF   0
+#define LEDON    1
+
+#define PER_LINE_PARAM "/sys/module/gpioled/parameters/per_line"
+
+struct cpu_sample {
+    unsigned long long busy;
+    unsigned long long total;
+};
+
+static int read_cpu(struct cpu_sample *s)
+{
+    unsigned long long v[8] = { 0 };
+    FILE *f = fopen("/proc/stat", "r");
+    int i = 0;
+
+    if (f == NULL) {
+        return -1;
+    }
+    if (fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+               &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) != 8) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    s->total = 0;
+    for (i = 0; i < 8; i++) {
+        s->total += v[i];
+    }
+    s->busy = s->total - v[3] - v[4];   /* 去掉 idle 与 iowait */
+    return 0;
+}
+
+static double proc_cpu_ms(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3 +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+static int write_attr(const char *led, const char *attr, const char *val)
+{
+    char path[128];
+    int fd = 0;
+    int ret = 0;
+
+    snprintf(path, sizeof(path), "/sys/class/leds/%s/%s", led, attr);
+    fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        printf("open %s failed.\n", path);
+        return -1;
+    }
+    ret = write(fd, val, strlen(val));
+    close(fd);
+    return ret < 0 ? -1 : 0;
+}
+
+static void report(const char *mode, unsigned int hz, unsigned int secs,
+                   double cpu0, struct cpu_sample *s0)
+{
+    struct cpu_sample s1;
+
+    read_cpu(&s1);
+    printf("%s,%u,%u,%.1f,%.2f\n", mode, hz, secs, proc_cpu_ms() - cpu0,
+           s1.total > s0->total ? 100.0 * (s1.busy - s0->busy) / (s1.total - s0->total) : 0.0);
+}
+
+/* 用户空间循环，每半个周期写一次 */
+static int user_blink(const char *dev, unsigned int hz, unsigned int secs)
+{
+    struct timespec next, end;
+    struct cpu_sample s0;
+    unsigned char databuf[1];
+    long half_ns = 500000000L / hz;
+    double cpu0 = 0;
+    int fd = 0;
+    int on = 0;
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        printf("open %s failed.\n", dev);
+        return -1;
+    }
+
+    read_cpu(&s0);
+    cpu0 = proc_cpu_ms();
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    end = next;
+    end.tv_sec += secs;
+    while (next.tv_sec < end.tv_sec ||
+           (next.tv_sec == end.tv_sec && next.tv_nsec < end.tv_nsec)) {
+        on = !on;
+        databuf[0] = on ? LEDON : LEDOFF;
+        if (write(fd, databuf, 1) < 0) {
+            printf("LED Control Failed!\n");
+            close(fd);
+            return -1;
+        }
+        next.tv_nsec += half_ns;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    report("user", hz, secs, cpu0, &s0);
+
+    databuf[0] = LEDOFF;
+    write(fd, databuf, 1);
+    close(fd);
+    return 0;
+}
+
+/* 内核 timer 触发器，本进程只负责配置与睡眠 */
+static int trigger_blink(const char *led, unsigned int hz, unsigned int secs)
+{
+    struct cpu_sample s0;
+    char delay[16];
+    double cpu0 = 0;
+
+    if (write_attr(led, "trigger", "timer") < 0) {
+        return -1;
+    }
+    snprintf(delay, sizeof(delay), "%u", 500 / hz ? 500 / hz : 1);
+    write_attr(led, "delay_on", delay);
+    write_attr(led, "delay_off", delay);
+
+    read_cpu(&s0);
+    cpu0 = proc_cpu_ms();
+    sleep(secs);
+    report("trigger", hz, secs, cpu0, &s0);
+
+    write_attr(led, "trigger", "none");
+    write_attr(led, "brightness", "0");
+    return 0;
+}
+
+static int set_per_line(int on)
+{
+    int fd = open(PER_LINE_PARAM, O_WRONLY);
+    int ret = 0;
+
+    if (fd < 0) {
+        printf("open %s failed.\n", PER_LINE_PARAM);
+        return -1;
+    }
+    ret = write(fd, on ? "1" : "0", 1);
+    close(fd);
+    return ret < 0 ? -1 : 0;
+}
+
+static double elapsed(struct timespec *t0, struct timespec *t1)
+{
+    return (t1->tv_sec - t0->tv_sec) + (t1->tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+static int set_bench(const char *dev, unsigned long count)
+{
+    static const char *names[] = { "array:   ", "per-line:" };
+    struct timespec t0, t1;
+    unsigned int mask = 0;
+    unsigned long i = 0;
+    int fd = 0;
+    int m = 0;
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        printf("open %s failed.\n", dev);
+        return -1;
+    }
+
+    for (m = 0; m < 2; m++) {
+        if (set_per_line(m) < 0) {
+            close(fd);
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (i = 0; i < count; i++) {
+            mask = (i & 1) ? 0xFFFFFFFF : 0;
+            if (write(fd, &mask, sizeof(mask)) < 0) {
+                printf("LED Control Failed!\n");
+                close(fd);
+                return -1;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        printf("%s %lu updates in %.3f s, %.0f updates/s\n",
+               names[m], count, elapsed(&t0, &t1), count / elapsed(&t0, &t1));
+    }
+
+    set_per_line(0);
+    close(fd);
+    return 0;
+}
+
+static void print_errors(const char *path, const char *when)
+{
+    char line[64];
+    FILE *f = fopen(path, "r");
+
+    if (f == NULL) {
+        printf("%s errors: n/a\n", when);
+        return;
+    }
+    printf("%s errors:", when);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = 0;
+        printf(" %s", line);
+    }
+    printf("\n");
+    fclose(f);
+}
+
+static int bad_bench(const char *dev, unsigned long count)
+{
+    struct timespec t0, t1;
+    struct stat st;
+    unsigned char databuf[1] = { 0xFF };
+    unsigned long rejected = 0;
+    unsigned long i = 0;
+    char path[64];
+    int fd = 0;
+
+    fd = open(dev, O_RDWR);
+    if (fd < 0) {
+        printf("open %s failed.\n", dev);
+        return -1;
+    }
+    fstat(fd, &st);
+    snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/errors",
+             major(st.st_rdev), minor(st.st_rdev));
+
+    print_errors(path, "before");
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < count; i++) {
+        if (write(fd, databuf, 1) < 0) {
+            rejected++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    printf("%lu invalid writes in %.3f s, %.0f writes/s, %lu rejected\n",
+           count, elapsed(&t0, &t1), count / elapsed(&t0, &t1), rejected);
+    print_errors(path, "after");
+
+    close(fd);
+    return 0;
+}
+
+/* 基线：什么都不做时的整机占用 */
+static void idle_baseline(unsigned int secs)
+{
+    struct cpu_sample s0;
+    double cpu0 = proc_cpu_ms();
+
+    read_cpu(&s0);
+    sleep(secs);
+    report("idle", 0, secs, cpu0, &s0);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int hz = 0;
+    unsigned int secs = 0;
+
+    if (argc == 4 && strcmp(argv[1], "setbench") == 0) {
+        return set_bench(argv[2], strtoul(argv[3], NULL, 0));
+    }
+    if (argc == 4 && strcmp(argv[1], "badbench") == 0) {
+        return bad_bench(argv[2], strtoul(argv[3], NULL, 0));
+    }
+    if (argc != 5) {
+        printf("usage: %s <dev> <led> <hz> <seconds>, %s setbench|badbench <dev> <count>\n",
+               argv[0], argv[0]);
+        return -1;
+    }
+    hz = strtoul(argv[3], NULL, 0);
+    secs = strtoul(argv[4], NULL, 0);
+    if (hz == 0 || hz > 500 || secs == 0) {
+        printf("param out of range.\n");
+        return -1;
+    }
+
+    printf("mode,hz,seconds,proc_cpu_ms,sys_busy_pct\n");
+    idle_baseline(secs);
+    if (user_blink(argv[1], hz, secs) < 0) {
+        return -1;
+    }
+    if (trigger_blink(argv[2], hz, secs) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -12,6 +12,16 @@
 #include <linux/slab.h>
 #include <linux/gpio.h>
 #include <linux/of_gpio.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/leds.h>
+
+#include "../common/fop_stats.h"
+#include "../common/err_stats.h"
+
+#define CREATE_TRACE_POINTS
+#include "beep_trace.h"
 
 #define BEEP_CNT 1
 #define BEEP_NAME "beep"
@@ -29,10 +39,95 @@ struct beep_dev {
     struct device *device;  /* 设备 */
     struct device_node *nd; /* 设备节点 */
     int beep_gpio;
+    struct led_classdev led;    /* LED 子系统接口，内核触发器直接驱动 */
+    struct hrtimer blink_timer; /* blink_set 交给这里，用户进程退出后继续闪烁 */
+    spinlock_t blink_lock;
+    u32 blink_gen;          /* 每次停止或重新设置闪烁加一 */
+    u32 blink_timer_gen;    /* 最近一次启动定时器时的 blink_gen */
+    bool blink_on;
+    u64 blink_on_ns;
+    u64 blink_off_ns;
+    struct err_stats errors;
 };
 
 struct beep_dev beep;
 
+static void beep_set_level(bool on)
+{
+    trace_beep_set(on);
+    gpio_set_value(beep.beep_gpio, on ? 0 : 1);     /* 低电平鸣叫 */
+}
+
+static enum hrtimer_restart beep_blink_func(struct hrtimer *timer)
+{
+    spin_lock(&beep.blink_lock);
+    /*
+     * 停止后 blink_gen 已变；停止后又重新设置时定时器已被 hrtimer_start 重新入队。
+     * 两种情况下这次回调都已过期，不能再推进到期时间或重启，否则同一定时器入队两次
+     */
+    if (beep.blink_timer_gen != beep.blink_gen || hrtimer_is_queued(timer)) {
+        spin_unlock(&beep.blink_lock);
+        return HRTIMER_NORESTART;
+    }
+    beep.blink_on = !beep.blink_on;
+    beep_set_level(beep.blink_on);
+    hrtimer_add_expires_ns(timer, beep.blink_on ? beep.blink_on_ns : beep.blink_off_ns);
+    spin_unlock(&beep.blink_lock);
+
+    return HRTIMER_RESTART;
+}
+
+/*
+ * 停止闪烁，返回后回调不会再改电平，sync 为假时可在原子上下文调用。
+ * sync 为真时还等待正在运行的回调结束，只在进程上下文使用
+ */
+static void beep_blink_stop(bool sync)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&beep.blink_lock, flags);
+    beep.blink_gen++;
+    spin_unlock_irqrestore(&beep.blink_lock, flags);
+    if (sync) {
+        hrtimer_cancel(&beep.blink_timer);
+    } else {
+        hrtimer_try_to_cancel(&beep.blink_timer);
+    }
+}
+
+/* timer 触发器优先调用这里，闪烁由驱动的 hrtimer 完成，LED 核心不再跑软件定时器 */
+static int beep_blink_set(struct led_classdev *led, unsigned long *delay_on,
+                           unsigned long *delay_off)
+{
+    unsigned long flags;
+
+    if (*delay_on == 0 && *delay_off == 0) {
+        *delay_on = 500;    /* LED 核心约定的默认周期 */
+        *delay_off = 500;
+    }
+
+    beep_blink_stop(false);
+    spin_lock_irqsave(&beep.blink_lock, flags);
+    beep.blink_on = (*delay_on != 0);
+    beep_set_level(beep.blink_on);
+    if (*delay_on && *delay_off) {
+        beep.blink_on_ns = (u64)*delay_on * NSEC_PER_MSEC;
+        beep.blink_off_ns = (u64)*delay_off * NSEC_PER_MSEC;
+        beep.blink_timer_gen = beep.blink_gen;
+        hrtimer_start(&beep.blink_timer, ns_to_ktime(beep.blink_on_ns), HRTIMER_MODE_REL);
+    }
+    spin_unlock_irqrestore(&beep.blink_lock, flags);
+
+    return 0;
+}
+
+/* 可能在触发器的软中断或定时器上下文中调用，不能睡眠 */
+static void beep_brightness_set(struct led_classdev *led, enum led_brightness value)
+{
+    beep_blink_stop(false);
+    beep_set_level(value != LED_OFF);
+}
+
 static int beep_open(struct inode *inode, struct file *filp)
 {
     filp->private_data = &beep;
@@ -45,30 +140,48 @@ static ssize_t beep_read(struct file *filp, char __user *buf,
     return 0;
 }
 
-static ssize_t beep_write(struct file *filp, const char __user *buf,  
+static ssize_t beep_do_write(struct file *filp, const char __user *buf,
                                 size_t cnt, loff_t *offt)
 {
     int ret = 0;
     uint8_t data[1];
 
-    ret = copy_from_user(data, buf, cnt);
-    if (ret < 0) {
-        printk("kernel write failed.\n");
+    ret = copy_from_user(data, buf, sizeof(data));
+    if (ret != 0) {
+        atomic_long_inc(&beep.errors.fault);
+        dev_dbg_ratelimited(beep.device, "kernel write failed.\n");
         return -1;
     }
 
+    if (data[0] == BEEP_ON || data[0] == BEEP_OFF) {
+        beep_blink_stop(true);  /* 用户写入优先于触发器的闪烁 */
+    }
+
     if (data[0] == BEEP_ON) {
-        gpio_set_value(beep.beep_gpio, 0);
+        beep_set_level(true);
     } else if (data[0] == BEEP_OFF) {
-        gpio_set_value(beep.beep_gpio, 1);
+        beep_set_level(false);
     } else {
-        printk("param out of range.\n");
+        atomic_long_inc(&beep.errors.inval);
+        dev_dbg_ratelimited(beep.device, "param out of range.\n");
         return -1;
     }
     
     return 0;
 }
 
+static ssize_t beep_write(struct file *filp, const char __user *buf,  
+                                size_t cnt, loff_t *offt)
+{
+    ssize_t ret = 0;
+
+    trace_beep_write_enter(cnt);
+    ret = beep_do_write(filp, buf, cnt, offt);
+    trace_beep_write_exit(ret);
+
+    return ret;
+}
+
 static int beep_release(struct inode *inode, struct file *filp)
 {
     return 0;
@@ -83,6 +196,11 @@ static struct file_operations beep_fops = {
     .release = beep_release, 
 };
 
+static const struct attribute_group *beep_groups[] = {
+    &err_stats_group,
+    NULL,
+};
+
 static int __init beep_init(void)
 {
     int ret = 0;
@@ -98,7 +216,7 @@ static int __init beep_init(void)
 
     /* 添加字符设备 */
     beep.cdev.owner = THIS_MODULE;
-    cdev_init(&beep.cdev, &beep_fops);
+    cdev_init(&beep.cdev, fop_stats_init(BEEP_NAME, &beep_fops));
     ret = cdev_add(&beep.cdev, beep.devid, BEEP_CNT);
     if (ret < 0) {
         printk("cdev_add failed.\n");
@@ -114,7 +232,8 @@ static int __init beep_init(void)
     }
 
     /* 创建设备 */
-    beep.device = device_create(beep.class, NULL, beep.devid, NULL, BEEP_NAME);
+    beep.device = device_create_with_groups(beep.class, NULL, beep.devid, &beep.errors,
+                                            beep_groups, BEEP_NAME);
     if (IS_ERR(beep.device)) {
         ret = PTR_ERR(beep.device);
         printk("device_create failed.\n");
@@ -156,8 +275,25 @@ static int __init beep_init(void)
     /* 输出低电平，开启蜂鸣器 */
     gpio_set_value(beep.beep_gpio, 0);
 
+    /* 注册到 LED 子系统，/sys/class/leds/beep */
+    spin_lock_init(&beep.blink_lock);
+    hrtimer_init(&beep.blink_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    beep.blink_timer.function = beep_blink_func;
+    beep.led.name = "beep";
+    beep.led.max_brightness = 1;
+    beep.led.brightness_set = beep_brightness_set;
+    beep.led.blink_set = beep_blink_set;
+    of_property_read_string(beep.nd, "linux,default-trigger", &beep.led.default_trigger);
+    ret = led_classdev_register(beep.device, &beep.led);
+    if (ret < 0) {
+        printk("led_classdev_register failed.\n");
+        goto fail_led;
+    }
+
     return 0;
 
+fail_led:
+    gpio_set_value(beep.beep_gpio, 1);
 fail_gpio_direction:
     /* 释放IO */
     gpio_free(beep.beep_gpio);
@@ -171,6 +307,7 @@ fail_class:
     /* 删除字符设备 */
     cdev_del(&beep.cdev);
 fail_cdev:
+    fop_stats_exit();
     /* 释放设备号 */
     unregister_chrdev_region(beep.devid, BEEP_CNT);
 fail_devid:
@@ -179,6 +316,9 @@ fail_devid:
 
 static void __exit beep_exit(void)
 {
+    /* 注销时 LED 核心会移除触发器并关闭 */
+    led_classdev_unregister(&beep.led);
+    beep_blink_stop(true);
     /* 停止蜂鸣器 */
     gpio_set_value(beep.beep_gpio, 1);
     /* 释放IO */
@@ -189,6 +329,7 @@ static void __exit beep_exit(void)
     class_destroy(beep.class);
     /* 删除字符设备 */
     cdev_del(&beep.cdev);
+    fop_stats_exit();
     /* 释放设备号 */
     unregister_chrdev_region(beep.devid, BEEP_CNT);
 }
@@ -0,0 +1,56 @@
+/*
+ * beep 跟踪点，关闭时只是一条不跳转的指令。
+ * /sys/kernel/debug/tracing/events/drv_beep/ 或 trace/ 下的脚本
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM drv_beep
+
+#if !defined(_BEEP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BEEP_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(beep_write_enter,
+    TP_PROTO(size_t cnt),
+    TP_ARGS(cnt),
+    TP_STRUCT__entry(
+        __field(size_t, cnt)
+    ),
+    TP_fast_assign(
+        __entry->cnt = cnt;
+    ),
+    TP_printk("cnt=%zu", __entry->cnt)
+);
+
+TRACE_EVENT(beep_write_exit,
+    TP_PROTO(ssize_t ret),
+    TP_ARGS(ret),
+    TP_STRUCT__entry(
+        __field(ssize_t, ret)
+    ),
+    TP_fast_assign(
+        __entry->ret = ret;
+    ),
+    TP_printk("ret=%zd", __entry->ret)
+);
+
+/* 每次改变输出，包括闪烁 */
+TRACE_EVENT(beep_set,
+    TP_PROTO(bool on),
+    TP_ARGS(on),
+    TP_STRUCT__entry(
+        __field(bool, on)
+    ),
+    TP_fast_assign(
+        __entry->on = on;
+    ),
+    TP_printk("%s", __entry->on ? "on" : "off")
+);
+
+#endif /* _BEEP_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE beep_trace
+#include <trace/define_trace.h>
@@ -13,6 +13,12 @@
 #include <linux/gpio.h>
 #include <linux/of_gpio.h>
 #include <linux/atomic.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/rcupdate.h>
+
+#include "../common/err_stats.h"
 
 #define GPIOLED_CNT 1
 #define GPIOLED_NAME "gpioled"
@@ -20,6 +26,46 @@
 #define LEDOFF 0
 #define LEDON 1
 
+/* 设备被占用时 open 排队等待，release 按到达顺序直接交给队首 */
+#define OPEN_TIMEOUT_CMD    _IOW(0xEF, 1, __u32)                      // 设置等待超时 ms，0 为一直等
+#define OPEN_STATS_CMD      _IOR(0xEF, 2, struct gpioled_wait_stats)  // 读取等待统计
+
+struct gpioled_wait_stats {
+    __u64 opens;        /* open 调用次数 */
+    __u64 waits;        /* 进入等待队列的次数 */
+    __u64 handoffs;     /* 等待后拿到设备的次数 */
+    __u64 busy;         /* O_NONBLOCK 直接返回 -EBUSY */
+    __u64 timeouts;
+    __u64 interrupts;   /* 等待中被信号打断 */
+    __u64 wait_avg_ns;  /* 拿到设备前的平均等待时间 */
+    __u64 wait_max_ns;
+    __u32 depth;        /* 当前排队进程数 */
+    __u32 depth_max;
+};
+
+/*
+ * O_RDONLY 打开者共享访问，不占用设备，read 返回状态快照；
+ * 读 1 字节只返回 LEDON/LEDOFF。
+ */
+struct led_state {
+    __u32 on;
+    __u32 readers;      /* 当前只读打开数 */
+    __u64 seq;          /* 每次写入加一，监视程序据此发现变化 */
+    __u64 changed_ns;   /* 最近一次写入的 CLOCK_MONOTONIC 时间 */
+};
+
+/* 状态快照，写者整体替换，读者在 RCU 读临界区内无锁读取 */
+struct gpioled_state {
+    struct led_state st;
+    struct rcu_head rcu;
+};
+
+/* 排队中的 open，栈上分配，granted 为真表示设备已交给它 */
+struct gpioled_waiter {
+    wait_queue_t wait;
+    bool granted;
+};
+
 /* gpioled设备结构体 */
 struct gpioled_dev {
     dev_t devid;
@@ -31,20 +77,152 @@ struct gpioled_dev {
     struct device_node *nd; /* 设备节点 */
     int led_gpio;
 
-    atomic_t lock;          /* 原子操作 */
+    atomic_t lock;          /* 原子操作，只管写者 */
+    atomic_t readers;       /* 只读打开者，不参与互斥 */
+    struct gpioled_state __rcu *state;
+    spinlock_t state_lock;  /* 串行化快照替换 */
+    wait_queue_head_t open_wq;  /* 排队等待 open 的进程，队列与统计由 open_wq.lock 保护 */
+    u32 open_timeout_ms;
+    atomic_t opens;
+    struct gpioled_wait_stats wstats;
+    u64 wait_sum_ns;
+    struct err_stats errors;
 };
 
 struct gpioled_dev gpioled;
 
+/*
+ * 排到队尾等待，调用者持有 dev->open_wq.lock，返回时仍持有。
+ * release 把设备直接交给队首，不会出现多个进程同时被唤醒再抢的情况。
+ */
+static int gpioled_wait_turn(struct gpioled_dev *dev)
+{
+    struct gpioled_waiter w;
+    long timeout = dev->open_timeout_ms ? msecs_to_jiffies(dev->open_timeout_ms) : MAX_SCHEDULE_TIMEOUT;
+    ktime_t start = ktime_get();
+    u64 ns = 0;
+    int ret = 0;
+
+    init_waitqueue_entry(&w.wait, current);
+    w.granted = false;
+    __add_wait_queue_tail_exclusive(&dev->open_wq, &w.wait);
+    dev->wstats.waits++;
+    dev->wstats.depth++;
+    dev->wstats.depth_max = max(dev->wstats.depth_max, dev->wstats.depth);
+
+    for (;;) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (w.granted) {
+            break;
+        }
+        if (signal_pending(current)) {
+            dev->wstats.interrupts++;
+            ret = -ERESTARTSYS;
+            break;
+        }
+        if (timeout == 0) {
+            dev->wstats.timeouts++;
+            ret = -ETIMEDOUT;
+            break;
+        }
+        spin_unlock(&dev->open_wq.lock);
+        timeout = schedule_timeout(timeout);
+        spin_lock(&dev->open_wq.lock);
+    }
+    __set_current_state(TASK_RUNNING);
+    dev->wstats.depth--;
+
+    /* 超时或信号与交接同时发生时以交接为准 */
+    if (!w.granted) {
+        __remove_wait_queue(&dev->open_wq, &w.wait);
+        return ret;
+    }
+    ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    dev->wait_sum_ns += ns;
+    dev->wstats.wait_max_ns = max(dev->wstats.wait_max_ns, ns);
+
+    return 0;
+}
+
+/* 有人排队时把设备交给队首并返回真，调用者持有 dev->open_wq.lock */
+static bool gpioled_handoff(struct gpioled_dev *dev)
+{
+    struct gpioled_waiter *w = NULL;
+
+    if (list_empty(&dev->open_wq.task_list)) {
+        return false;
+    }
+    w = list_first_entry(&dev->open_wq.task_list, struct gpioled_waiter, wait.task_list);
+    __remove_wait_queue(&dev->open_wq, &w->wait);
+    w->granted = true;
+    dev->wstats.handoffs++;
+    /* 仍持有锁，等待者拿不到锁就不会返回，w 在此期间有效 */
+    wake_up_process(w->wait.private);
+
+    return true;
+}
+
+/* 设置 LED 并发布新快照，旧快照在已有读者退出临界区后释放 */
+static int gpioled_set_state(struct gpioled_dev *dev, u8 on)
+{
+    struct gpioled_state *new = NULL;
+    struct gpioled_state *old = NULL;
+
+    new = kmalloc(sizeof(*new), GFP_KERNEL);
+    if (new == NULL) {
+        return -ENOMEM;
+    }
+
+    spin_lock(&dev->state_lock);
+    old = rcu_dereference_protected(dev->state, lockdep_is_held(&dev->state_lock));
+    gpio_set_value(dev->led_gpio, on == LEDON ? 0 : 1);
+    new->st = old->st;
+    new->st.on = on;
+    new->st.seq++;
+    new->st.changed_ns = ktime_get_ns();
+    rcu_assign_pointer(dev->state, new);
+    spin_unlock(&dev->state_lock);
+    kfree_rcu(old, rcu);
+
+    return 0;
+}
+
 static int gpioled_open(struct inode *inode, struct file *filp)
 {
+    int ret = 0;
+
     filp->private_data = &gpioled;
+    atomic_inc(&gpioled.opens);
+
+    /* 只读打开不占用设备，监视程序不会挡住控制进程 */
+    if (!(filp->f_mode & FMODE_WRITE)) {
+        atomic_inc(&gpioled.readers);
+        return 0;
+    }
+
+    /* 判断lock，空闲时不加锁直接拿到 */
+    if (atomic_dec_and_test(&gpioled.lock)) {
+        return 0;
+    }
+    atomic_inc(&gpioled.lock);
 
-    /* 判断lock */
-    if (!atomic_dec_and_test(&gpioled.lock)) {
-        atomic_inc(&gpioled.lock);
+    spin_lock(&gpioled.open_wq.lock);
+    /* 持有者可能刚好释放，有人排队时 release 不会加一，这里不会插队 */
+    if (atomic_dec_and_test(&gpioled.lock)) {
+        spin_unlock(&gpioled.open_wq.lock);
+        return 0;
+    }
+    atomic_inc(&gpioled.lock);
+    if (filp->f_flags & O_NONBLOCK) {
+        gpioled.wstats.busy++;
+        spin_unlock(&gpioled.open_wq.lock);
         return -EBUSY;
     }
+    ret = gpioled_wait_turn(&gpioled);
+    spin_unlock(&gpioled.open_wq.lock);
+    if (ret < 0) {
+        return ret;
+    }
 
 #if 0
     if (atomic_read(&gpioled.lock) <= 0) {
@@ -60,28 +238,54 @@ static int gpioled_open(struct inode *inode, struct file *filp)
 static ssize_t gpioled_read(struct file *filp, char __user *buf,     
                                size_t cnt, loff_t *offt)
 {
-    return 0;
+    struct gpioled_dev *dev = filp->private_data;
+    struct led_state st;
+    u8 data = 0;
+
+    if (cnt < sizeof(data)) {
+        return -EINVAL;
+    }
+
+    rcu_read_lock();
+    st = rcu_dereference(dev->state)->st;
+    rcu_read_unlock();
+    st.readers = atomic_read(&dev->readers);
+
+    if (cnt < sizeof(st)) {
+        data = st.on;
+        if (copy_to_user(buf, &data, sizeof(data))) {
+            return -EFAULT;
+        }
+        return sizeof(data);
+    }
+    if (copy_to_user(buf, &st, sizeof(st))) {
+        return -EFAULT;
+    }
+    return sizeof(st);
 }
 
 static ssize_t gpioled_write(struct file *filp, const char __user *buf,  
                                 size_t cnt, loff_t *offt)
 {
+    struct gpioled_dev *dev = filp->private_data;
     int ret = 0;
     uint8_t data[1];
 
-    ret = copy_from_user(data, buf, cnt);
-    if (ret < 0) {
-        printk("kernel write failed.\n");
-        return -1;
+    ret = copy_from_user(data, buf, sizeof(data));
+    if (ret != 0) {
+        atomic_long_inc(&dev->errors.fault);
+        dev_dbg_ratelimited(dev->device, "kernel write failed.\n");
+        return -EFAULT;
     }
 
-    if (data[0] == LEDON) {
-        gpio_set_value(gpioled.led_gpio, 0);
-    } else if (data[0] == LEDOFF) {
-        gpio_set_value(gpioled.led_gpio, 1);
-    } else {
-        printk("param out of range.\n");
-        return -1;
+    if (data[0] != LEDON && data[0] != LEDOFF) {
+        atomic_long_inc(&dev->errors.inval);
+        dev_dbg_ratelimited(dev->device, "param out of range.\n");
+        return -EINVAL;
+    }
+    ret = gpioled_set_state(dev, data[0]);
+    if (ret < 0) {
+        return ret;
     }
     
     return 0;
@@ -91,26 +295,87 @@ static int gpioled_release(struct inode *inode, struct file *filp)
 {
     struct gpioled_dev *dev = filp->private_data;
 
-    atomic_inc(&dev->lock); /* 加一，释放驱动 */
+    if (!(filp->f_mode & FMODE_WRITE)) {
+        atomic_dec(&dev->readers);
+        return 0;
+    }
+
+    spin_lock(&dev->open_wq.lock);
+    if (!gpioled_handoff(dev)) {
+        atomic_inc(&dev->lock); /* 加一，释放驱动 */
+    }
+    spin_unlock(&dev->open_wq.lock);
 
     return 0;
 }
 
+static long gpioled_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct gpioled_dev *dev = filp->private_data;
+    struct gpioled_wait_stats st;
+    u32 ms = 0;
+
+    switch (cmd)
+    {
+    case OPEN_TIMEOUT_CMD:
+        if (!(filp->f_mode & FMODE_WRITE)) {
+            return -EPERM;  /* 等待策略归写者设置 */
+        }
+        if (copy_from_user(&ms, (void __user *)arg, sizeof(ms))) {
+            return -EFAULT;
+        }
+        spin_lock(&dev->open_wq.lock);
+        dev->open_timeout_ms = ms;  /* 对之后进入队列的 open 生效 */
+        spin_unlock(&dev->open_wq.lock);
+        return 0;
+    case OPEN_STATS_CMD:
+        spin_lock(&dev->open_wq.lock);
+        st = dev->wstats;
+        st.wait_avg_ns = st.handoffs ? div64_u64(dev->wait_sum_ns, st.handoffs) : 0;
+        spin_unlock(&dev->open_wq.lock);
+        st.opens = atomic_read(&dev->opens);
+        if (copy_to_user((void __user *)arg, &st, sizeof(st))) {
+            return -EFAULT;
+        }
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
 /* 字符设备操作集合 */
 static struct file_operations gpioled_fops = { 
     .owner = THIS_MODULE,
     .open = gpioled_open, 
     .read = gpioled_read, 
     .write = gpioled_write, 
+    .unlocked_ioctl = gpioled_ioctl,
     .release = gpioled_release, 
 };
 
+static const struct attribute_group *gpioled_groups[] = {
+    &err_stats_group,
+    NULL,
+};
+
 static int __init led_init(void)
 {
     int ret = 0;
+    struct gpioled_state *state = NULL;
 
     /* 初始化原子变量 */
     atomic_set(&gpioled.lock, 1);
+    init_waitqueue_head(&gpioled.open_wq);
+
+    /* 初始状态快照，与下面点亮 LED 一致 */
+    spin_lock_init(&gpioled.state_lock);
+    state = kzalloc(sizeof(*state), GFP_KERNEL);
+    if (state == NULL) {
+        return -ENOMEM;
+    }
+    state->st.on = LEDON;
+    state->st.changed_ns = ktime_get_ns();
+    RCU_INIT_POINTER(gpioled.state, state);
 
     /* 注册设备号 */
     ret = alloc_chrdev_region(&gpioled.devid, 0, GPIOLED_CNT, GPIOLED_NAME);
@@ -140,7 +405,8 @@ static int __init led_init(void)
     }
 
     /* 创建设备 */
-    gpioled.device = device_create(gpioled.class, NULL, gpioled.devid, NULL, GPIOLED_NAME);
+    gpioled.device = device_create_with_groups(gpioled.class, NULL, gpioled.devid, &gpioled.errors,
+                                               gpioled_groups, GPIOLED_NAME);
     if (IS_ERR(gpioled.device)) {
         ret = PTR_ERR(gpioled.device);
         printk("device_create failed.\n");
@@ -200,6 +466,7 @@ fail_cdev:
     /* 释放设备号 */
     unregister_chrdev_region(gpioled.devid, GPIOLED_CNT);
 fail_devid:
+    kfree(state);
     return ret;
 }
 
@@ -217,6 +484,8 @@ static void __exit led_exit(void)
     cdev_del(&gpioled.cdev);
     /* 释放设备号 */
     unregister_chrdev_region(gpioled.devid, GPIOLED_CNT);
+    /* 已无打开者，之前 kfree_rcu 的旧快照由 RCU 自行释放 */
+    kfree(rcu_dereference_protected(gpioled.state, 1));
 }
 
 /* 模块入口与出口 */
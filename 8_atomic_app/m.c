@@ -1,55 +1,396 @@
-#include "stdio.h"
-#include "unistd.h"
-#include "sys/types.h"
-#include "sys/stat.h"
-#include "fcntl.h"
-#include "stdlib.h"
-#include "string.h"
-
-#define LEDOFF   0 
+/*
+8_atomic / 9_spinlock 独占打开的负载测试，结果以 CSV 输出到 stdout
+
+./atomicApp [-d dev] [-n workers] [-P] [-T ms | -c cycles] [-h us] [-k us] [-o ms] [-N]
+    -d  设备路径，默认 /dev/gpioled
+    -n  并发数，默认 4
+    -P  用进程代替线程
+    -T  测试时长(ms)，默认 5000；-c 改为每个并发执行固定轮数
+    -h  每轮打开后占用设备的时间(us)，默认 1000
+    -k  两轮之间的思考时间(us)，在 0..2k 内均匀随机，默认 1000
+    -o  设置驱动的 open 等待超时(ms)，不设则保持驱动当前值
+    -N  以 O_NONBLOCK 打开，被占用时立即 EBUSY
+./atomicApp -W <seconds> [-d dev]
+    只读打开监视状态快照(8_atomic)，变化时打印
+
+每轮 open -> write 亮/灭 -> 占用 -> close，open 失败按 errno 分类计数。
+open_* 为成功 open 的耗时(含排队)，write_* 为 write 耗时。结束后打印驱动的等待统计。
+编译: gcc -O2 -pthread m.c -o atomicApp
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+#define DEVICE_PATH "/dev/gpioled"
+
+#define LEDOFF   0
 #define LEDON    1
 
-int main(int argc, char *argv[]) 
-{ 
-    int fd = 0;
-    int ret = 0;
+#define OPEN_TIMEOUT_CMD    _IOW(0xEF, 1, __u32)                      // 设置等待超时 ms，0 为一直等
+#define OPEN_STATS_CMD      _IOR(0xEF, 2, struct gpioled_wait_stats)  // 读取等待统计
+
+struct gpioled_wait_stats {
+    __u64 opens;
+    __u64 waits;
+    __u64 handoffs;
+    __u64 busy;
+    __u64 timeouts;
+    __u64 interrupts;
+    __u64 wait_avg_ns;
+    __u64 wait_max_ns;
+    __u32 depth;
+    __u32 depth_max;
+};
+
+struct led_state {
+    __u32 on;
+    __u32 readers;
+    __u64 seq;
+    __u64 changed_ns;
+};
+
+#define MAX_WORKERS     64
+#define MAX_SAMPLES     (1 << 14)   // 每个并发保留的延迟样本数
+
+/* 放在共享内存里，进程模式下子进程直接写回 */
+struct load_worker {
+    pthread_t tid;
+    unsigned int id;
+    unsigned long long attempts;
+    unsigned long long success;
+    unsigned long long ebusy;
+    unsigned long long etimedout;
+    unsigned long long other;
+    int last_err;
+    unsigned int nopen;
+    unsigned int nwrite;
+    unsigned long long open_ns[MAX_SAMPLES];
+    unsigned long long write_ns[MAX_SAMPLES];
+};
+
+static const char *dev_path = DEVICE_PATH;
+static unsigned int duration_ms = 5000;
+static unsigned long long cycles;
+static unsigned int hold_us = 1000;
+static unsigned int think_us = 1000;
+static int nonblock;
+static unsigned long long deadline_ns;
+
+static unsigned long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_us(unsigned int us)
+{
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000L };
+
+    if (us) {
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void record(unsigned long long *v, unsigned int *n, unsigned long long seq,
+                   unsigned long long ns)
+{
+    /* 超出容量后按环形覆盖，保留最近的样本 */
+    v[seq % MAX_SAMPLES] = ns;
+    if (*n < MAX_SAMPLES) {
+        (*n)++;
+    }
+}
+
+static void load_loop(struct load_worker *w)
+{
+    unsigned int seed = w->id * 7919 + 1;
     unsigned char databuf[1];
-    __uint8_t cnt = 0;
-    
-    if (argc != 3) {
-        printf("need 2 param.\n");
-        return -1;
+    unsigned long long t0 = 0;
+    int flags = O_RDWR | (nonblock ? O_NONBLOCK : 0);
+    int fd = 0;
+
+    while (cycles ? w->attempts < cycles : now_ns() < deadline_ns) {
+        w->attempts++;
+        t0 = now_ns();
+        fd = open(dev_path, flags);
+        if (fd < 0) {
+            if (errno == EBUSY) {
+                w->ebusy++;
+            } else if (errno == ETIMEDOUT) {
+                w->etimedout++;
+            } else {
+                w->other++;
+                w->last_err = errno;
+            }
+        } else {
+            record(w->open_ns, &w->nopen, w->success, now_ns() - t0);
+            databuf[0] = (w->success & 1) ? LEDOFF : LEDON;
+            t0 = now_ns();
+            if (write(fd, databuf, 1) < 0) {
+                w->other++;
+                w->last_err = errno;
+            } else {
+                record(w->write_ns, &w->nwrite, w->success, now_ns() - t0);
+            }
+            w->success++;
+            sleep_us(hold_us);
+            close(fd);
+        }
+        if (think_us) {
+            sleep_us(rand_r(&seed) % (2 * think_us + 1));
+        }
+    }
+}
+
+static void *load_thread(void *arg)
+{
+    load_loop(arg);
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+static double pct_us(unsigned long long *v, unsigned int n, double p)
+{
+    if (n == 0) {
+        return 0.0;
     }
-    
-    /* 打开led驱动 */
-    fd = open(argv[1], O_RDWR);
+    return v[(unsigned int)(p * (n - 1))] / 1000.0;
+}
+
+/* 把各并发的样本合并排序，n 返回样本数 */
+static unsigned long long *merge(struct load_worker *w, int nworkers, int open_lat, unsigned int *n)
+{
+    unsigned long long *all = malloc((size_t)nworkers * MAX_SAMPLES * sizeof(unsigned long long));
+    int i = 0;
+
+    *n = 0;
+    if (all == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < nworkers; i++) {
+        if (open_lat) {
+            memcpy(all + *n, w[i].open_ns, w[i].nopen * sizeof(unsigned long long));
+            *n += w[i].nopen;
+        } else {
+            memcpy(all + *n, w[i].write_ns, w[i].nwrite * sizeof(unsigned long long));
+            *n += w[i].nwrite;
+        }
+    }
+    qsort(all, *n, sizeof(unsigned long long), cmp_u64);
+    return all;
+}
+
+static void print_stats(void)
+{
+    struct gpioled_wait_stats st;
+    int fd = open(dev_path, O_RDONLY | O_NONBLOCK);
+
     if (fd < 0) {
-        printf("open %s failed.\n", argv[1]);
+        return;
+    }
+    if (ioctl(fd, OPEN_STATS_CMD, &st) == 0) {
+        fprintf(stderr, "driver: opens %llu, waits %llu, handoffs %llu, busy %llu, timeouts %llu, "
+                "interrupts %llu, wait avg %llu us, max %llu us, max depth %u\n",
+                st.opens, st.waits, st.handoffs, st.busy, st.timeouts, st.interrupts,
+                st.wait_avg_ns / 1000, st.wait_max_ns / 1000, st.depth_max);
+    }
+    close(fd);
+}
+
+/* 只读监视，与控制进程同时打开也不会被挡住 */
+static int watch(unsigned int secs)
+{
+    struct led_state st;
+    unsigned long long last = ~0ULL;
+    unsigned int i = 0;
+    int fd = 0;
+
+    fd = open(dev_path, O_RDONLY);
+    if (fd < 0) {
+        printf("open %s failed: %s.\n", dev_path, strerror(errno));
         return -1;
     }
+    for (i = 0; i < secs * 20; i++) {
+        if (read(fd, &st, sizeof(st)) != sizeof(st)) {
+            printf("read %s failed.\n", dev_path);
+            close(fd);
+            return -1;
+        }
+        if (st.seq != last) {
+            printf("seq %llu: %s, changed at %llu.%06llu, %u readers\n", st.seq,
+                   st.on ? "on" : "off", st.changed_ns / 1000000000ULL,
+                   st.changed_ns % 1000000000ULL / 1000, st.readers);
+            last = st.seq;
+        }
+        usleep(50000);
+    }
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct load_worker *w = NULL;
+    unsigned long long *lat = NULL;
+    unsigned long long t0 = 0;
+    unsigned long long attempts = 0, success = 0, ebusy = 0, etimedout = 0, other = 0;
+    unsigned int n_open = 0;
+    unsigned int n_write = 0;
+    unsigned int watch_secs = 0;
+    unsigned int nworkers = 4;
+    double open_p[4];
+    double secs = 0.0;
+    pid_t pids[MAX_WORKERS];
+    __u32 timeout_ms = 0;
+    int set_timeout = 0;
+    int use_proc = 0;
+    int fd = 0;
+    int opt = 0;
+    int i = 0;
 
-    databuf[0] = atoi(argv[2]); /* 要执行的操作：打开或关闭 */
-    if ((databuf[0] != 0) && (databuf[0] !=1)) {
+    while ((opt = getopt(argc, argv, "d:n:PT:c:h:k:o:NW:")) != -1) {
+        switch (opt) {
+        case 'd':
+            dev_path = optarg;
+            break;
+        case 'n':
+            nworkers = strtoul(optarg, NULL, 0);
+            break;
+        case 'P':
+            use_proc = 1;
+            break;
+        case 'T':
+            duration_ms = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            cycles = strtoull(optarg, NULL, 0);
+            break;
+        case 'h':
+            hold_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            think_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            timeout_ms = strtoul(optarg, NULL, 0);
+            set_timeout = 1;
+            break;
+        case 'N':
+            nonblock = 1;
+            break;
+        case 'W':
+            watch_secs = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            printf("usage: %s [-d dev] [-n workers] [-P] [-T ms | -c cycles] [-h us] [-k us] [-o ms] [-N]\n"
+                   "       %s -W <seconds> [-d dev]\n", argv[0], argv[0]);
+            return -1;
+        }
+    }
+    if (watch_secs) {
+        return watch(watch_secs);
+    }
+    if (nworkers < 1 || nworkers > MAX_WORKERS || (duration_ms == 0 && cycles == 0)) {
         printf("param out of range.\n");
-        close(fd);
         return -1;
     }
 
-    /* 向/dev/led文件写入数据 */
-    ret = write(fd, databuf, 1);
-    if (ret < 0) {
-        printf("LED Control Failed!\n");
+    /* 超时是设备级设置，开始前打开一次设置好 */
+    if (set_timeout) {
+        fd = open(dev_path, O_RDWR);
+        if (fd < 0 || ioctl(fd, OPEN_TIMEOUT_CMD, &timeout_ms) < 0) {
+            printf("set open timeout on %s failed: %s.\n", dev_path, strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
         close(fd);
+    }
+
+    w = mmap(NULL, nworkers * sizeof(*w), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (w == MAP_FAILED) {
+        printf("mmap failed.\n");
         return -1;
     }
+    memset(w, 0, nworkers * sizeof(*w));
 
-    /* 模拟应用占用驱动25S */
-    printf("App running start!\n");
-    for (cnt = 0; cnt < 5; cnt++) {
-        sleep(5);
+    t0 = now_ns();
+    deadline_ns = t0 + duration_ms * 1000000ULL;
+    for (i = 0; i < (int)nworkers; i++) {
+        w[i].id = i;
+        if (use_proc) {
+            pids[i] = fork();
+            if (pids[i] == 0) {
+                load_loop(&w[i]);
+                _exit(0);
+            }
+        } else {
+            pthread_create(&w[i].tid, NULL, load_thread, &w[i]);
+        }
     }
-    printf("App running finished!\n");
+    for (i = 0; i < (int)nworkers; i++) {
+        if (use_proc) {
+            if (pids[i] > 0) {
+                waitpid(pids[i], NULL, 0);
+            }
+        } else {
+            pthread_join(w[i].tid, NULL);
+        }
+    }
+    secs = (now_ns() - t0) / 1e9;
 
-    close(fd);
+    for (i = 0; i < (int)nworkers; i++) {
+        attempts += w[i].attempts;
+        success += w[i].success;
+        ebusy += w[i].ebusy;
+        etimedout += w[i].etimedout;
+        other += w[i].other;
+        if (w[i].last_err) {
+            fprintf(stderr, "worker %d: %s\n", i, strerror(w[i].last_err));
+        }
+    }
+
+    lat = merge(w, nworkers, 1, &n_open);
+    open_p[0] = pct_us(lat, n_open, 0.50);
+    open_p[1] = pct_us(lat, n_open, 0.90);
+    open_p[2] = pct_us(lat, n_open, 0.99);
+    open_p[3] = n_open ? lat[n_open - 1] / 1000.0 : 0.0;
+    free(lat);
+    lat = merge(w, nworkers, 0, &n_write);
+
+    printf("workers,kind,nonblock,hold_us,think_us,seconds,attempts,success,ebusy,etimedout,other,"
+           "success_per_s,open_p50_us,open_p90_us,open_p99_us,open_max_us,write_p50_us,write_p99_us\n");
+    printf("%u,%s,%d,%u,%u,%.3f,%llu,%llu,%llu,%llu,%llu,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+           nworkers, use_proc ? "proc" : "thread", nonblock, hold_us, think_us, secs,
+           attempts, success, ebusy, etimedout, other, success / secs,
+           open_p[0], open_p[1], open_p[2], open_p[3],
+           pct_us(lat, n_write, 0.50), pct_us(lat, n_write, 0.99));
+    free(lat);
+    print_stats();
+
+    munmap(w, nworkers * sizeof(*w));
     return 0;
 }
@@ -13,6 +13,15 @@
 #include <linux/gpio.h>
 #include <linux/of_gpio.h>
 #include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "../common/pcpu_stats.h"
+#include "../common/err_stats.h"
 
 #define GPIOLED_CNT 1
 #define GPIOLED_NAME "gpioled"
@@ -20,6 +29,29 @@
 #define LEDOFF 0
 #define LEDON 1
 
+/* 设备被占用时 open 排队等待，release 按到达顺序直接交给队首 */
+#define OPEN_TIMEOUT_CMD    _IOW(0xEF, 1, __u32)                      // 设置等待超时 ms，0 为一直等
+#define OPEN_STATS_CMD      _IOR(0xEF, 2, struct gpioled_wait_stats)  // 读取等待统计
+
+struct gpioled_wait_stats {
+    __u64 opens;        /* open 调用次数 */
+    __u64 waits;        /* 进入等待队列的次数 */
+    __u64 handoffs;     /* 等待后拿到设备的次数 */
+    __u64 busy;         /* O_NONBLOCK 直接返回 -EBUSY */
+    __u64 timeouts;
+    __u64 interrupts;   /* 等待中被信号打断 */
+    __u64 wait_avg_ns;  /* 拿到设备前的平均等待时间 */
+    __u64 wait_max_ns;
+    __u32 depth;        /* 当前排队进程数 */
+    __u32 depth_max;
+};
+
+/* 排队中的 open，栈上分配，granted 为真表示设备已交给它 */
+struct gpioled_waiter {
+    wait_queue_t wait;
+    bool granted;
+};
+
 /* gpioled设备结构体 */
 struct gpioled_dev {
     dev_t devid;
@@ -33,22 +65,212 @@ struct gpioled_dev {
 
     int dev_status;         /* 0表示设备可以使用，大于等于1表示不可使用 */
     spinlock_t lock;
+    wait_queue_head_t open_wq;  /* 排队等待 open 的进程，与统计一起由 lock 保护 */
+    u32 open_timeout_ms;
+    struct gpioled_wait_stats wstats;
+    u64 wait_sum_ns;
+
+    u64 lock_t0;            /* 本次持有开始时间，0 表示加锁时未统计 */
+    struct dentry *debugfs;
+    struct err_stats errors;
 };
 
 struct gpioled_dev gpioled;
 
+/*
+ * lock 的等待与持有时间统计，/sys/kernel/debug/gpioled/ 下 lock_enable 与 lock_stats，
+ * 开关与读出、清零见 pcpu_stats.h。
+ */
+struct lock_stat {
+    u64 acquired;
+    u64 contended;          /* 第一次 trylock 未成功 */
+    u64 wait_max_ns;
+    u64 hold_max_ns;
+    u64 wait[PCPU_HIST_BUCKETS];
+    u64 hold[PCPU_HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct lock_stat, lock_stats);
+
+static void lock_stat_merge(void *sum, const void *pcp)
+{
+    struct lock_stat *s = sum;
+    const struct lock_stat *p = pcp;
+
+    s->acquired += p->acquired;
+    s->contended += p->contended;
+    s->wait_max_ns = max(s->wait_max_ns, p->wait_max_ns);
+    s->hold_max_ns = max(s->hold_max_ns, p->hold_max_ns);
+    pcpu_hist_merge(s->wait, p->wait);
+    pcpu_hist_merge(s->hold, p->hold);
+}
+
+static void lock_stat_show(struct seq_file *m, const void *sum)
+{
+    const struct lock_stat *s = sum;
+
+    seq_printf(m, "acquired %llu\ncontended %llu\n", s->acquired, s->contended);
+    seq_printf(m, "wait_max_ns %llu\n", s->wait_max_ns);
+    pcpu_hist_print(m, "wait", s->wait);
+    seq_printf(m, "hold_max_ns %llu\n", s->hold_max_ns);
+    pcpu_hist_print(m, "hold", s->hold);
+}
+
+static struct pcpu_stats lock_stat = PCPU_STATS_INIT(lock_stat, &lock_stats, sizeof(struct lock_stat),
+                                                     lock_stat_merge, lock_stat_show);
+
+static noinline void gpioled_lock_slow(struct gpioled_dev *dev)
+{
+    struct lock_stat *st = NULL;
+    bool contended = false;
+    u64 t0 = local_clock();
+    u64 now = 0;
+
+    if (!spin_trylock(&dev->lock)) {
+        contended = true;
+        spin_lock(&dev->lock);
+    }
+    /* 持锁期间不可抢占，持有与释放在同一 CPU 上，local_clock 可直接相减 */
+    now = local_clock();
+    st = this_cpu_ptr(&lock_stats);
+    st->acquired++;
+    st->contended += contended;
+    st->wait[pcpu_hist_bucket(now - t0)]++;
+    st->wait_max_ns = max(st->wait_max_ns, now - t0);
+    dev->lock_t0 = now;
+}
+
+static noinline void gpioled_unlock_slow(struct gpioled_dev *dev)
+{
+    struct lock_stat *st = NULL;
+    u64 ns = 0;
+
+    if (dev->lock_t0) {
+        ns = local_clock() - dev->lock_t0;
+        dev->lock_t0 = 0;
+        st = this_cpu_ptr(&lock_stats);
+        st->hold[pcpu_hist_bucket(ns)]++;
+        st->hold_max_ns = max(st->hold_max_ns, ns);
+    }
+    spin_unlock(&dev->lock);
+}
+
+static inline void gpioled_lock(struct gpioled_dev *dev)
+{
+    if (pcpu_stats_enabled(&lock_stat)) {
+        gpioled_lock_slow(dev);
+        return;
+    }
+    spin_lock(&dev->lock);
+}
+
+/*
+ * 加锁与解锁各自判断 static key，开关可能恰好在临界区中间切换。
+ * 两条解锁路径都清零 lock_t0，下一次解锁不会拿到上一次临界区的开始时间
+ */
+static inline void gpioled_unlock(struct gpioled_dev *dev)
+{
+    if (pcpu_stats_enabled(&lock_stat)) {
+        gpioled_unlock_slow(dev);
+        return;
+    }
+    dev->lock_t0 = 0;
+    spin_unlock(&dev->lock);
+}
+
+/*
+ * 排到队尾等待，调用者持有 dev->lock，返回时仍持有。
+ * release 把设备直接交给队首，不会出现多个进程同时被唤醒再抢的情况。
+ */
+static int gpioled_wait_turn(struct gpioled_dev *dev)
+{
+    struct gpioled_waiter w;
+    long timeout = dev->open_timeout_ms ? msecs_to_jiffies(dev->open_timeout_ms) : MAX_SCHEDULE_TIMEOUT;
+    ktime_t start = ktime_get();
+    u64 ns = 0;
+    int ret = 0;
+
+    init_waitqueue_entry(&w.wait, current);
+    w.granted = false;
+    __add_wait_queue_tail_exclusive(&dev->open_wq, &w.wait);
+    dev->wstats.waits++;
+    dev->wstats.depth++;
+    dev->wstats.depth_max = max(dev->wstats.depth_max, dev->wstats.depth);
+
+    for (;;) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (w.granted) {
+            break;
+        }
+        if (signal_pending(current)) {
+            dev->wstats.interrupts++;
+            ret = -ERESTARTSYS;
+            break;
+        }
+        if (timeout == 0) {
+            dev->wstats.timeouts++;
+            ret = -ETIMEDOUT;
+            break;
+        }
+        gpioled_unlock(dev);
+        timeout = schedule_timeout(timeout);
+        gpioled_lock(dev);
+    }
+    __set_current_state(TASK_RUNNING);
+    dev->wstats.depth--;
+
+    /* 超时或信号与交接同时发生时以交接为准 */
+    if (!w.granted) {
+        __remove_wait_queue(&dev->open_wq, &w.wait);
+        return ret;
+    }
+    ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    dev->wait_sum_ns += ns;
+    dev->wstats.wait_max_ns = max(dev->wstats.wait_max_ns, ns);
+
+    return 0;
+}
+
+/* 有人排队时把设备交给队首并返回真，调用者持有 dev->lock */
+static bool gpioled_handoff(struct gpioled_dev *dev)
+{
+    struct gpioled_waiter *w = NULL;
+
+    if (list_empty(&dev->open_wq.task_list)) {
+        return false;
+    }
+    w = list_first_entry(&dev->open_wq.task_list, struct gpioled_waiter, wait.task_list);
+    __remove_wait_queue(&dev->open_wq, &w->wait);
+    w->granted = true;
+    dev->wstats.handoffs++;
+    /* 仍持有锁，等待者拿不到锁就不会返回，w 在此期间有效 */
+    wake_up_process(w->wait.private);
+
+    return true;
+}
+
 static int gpioled_open(struct inode *inode, struct file *filp)
 {
+    int ret = 0;
+
     filp->private_data = &gpioled;
 
-    spin_lock(&gpioled.lock);
+    gpioled_lock(&gpioled);
+    gpioled.wstats.opens++;
     if (gpioled.dev_status) {   // 驱动不能使用
-        spin_unlock(&gpioled.lock);
-        return -EBUSY;
+        if (filp->f_flags & O_NONBLOCK) {
+            gpioled.wstats.busy++;
+            gpioled_unlock(&gpioled);
+            return -EBUSY;
+        }
+        /* 交接时 dev_status 保持不变，拿到后直接使用 */
+        ret = gpioled_wait_turn(&gpioled);
+        gpioled_unlock(&gpioled);
+        return ret;
     }
 
     gpioled.dev_status++;   // 标记被使用
-    spin_unlock(&gpioled.lock);
+    gpioled_unlock(&gpioled);
     return 0;
 }
 
@@ -64,10 +286,11 @@ static ssize_t gpioled_write(struct file *filp, const char __user *buf,
     int ret = 0;
     uint8_t data[1];
 
-    ret = copy_from_user(data, buf, cnt);
-    if (ret < 0) {
-        printk("kernel write failed.\n");
-        return -1;
+    ret = copy_from_user(data, buf, sizeof(data));
+    if (ret != 0) {
+        atomic_long_inc(&gpioled.errors.fault);
+        dev_dbg_ratelimited(gpioled.device, "kernel write failed.\n");
+        return -EFAULT;
     }
 
     if (data[0] == LEDON) {
@@ -75,8 +298,9 @@ static ssize_t gpioled_write(struct file *filp, const char __user *buf,
     } else if (data[0] == LEDOFF) {
         gpio_set_value(gpioled.led_gpio, 1);
     } else {
-        printk("param out of range.\n");
-        return -1;
+        atomic_long_inc(&gpioled.errors.inval);
+        dev_dbg_ratelimited(gpioled.device, "param out of range.\n");
+        return -EINVAL;
     }
     
     return 0;
@@ -86,24 +310,60 @@ static int gpioled_release(struct inode *inode, struct file *filp)
 {
     struct gpioled_dev *dev = filp->private_data;
 
-    spin_lock(&dev->lock);
-    if (dev->dev_status) {
+    gpioled_lock(dev);
+    if (!gpioled_handoff(dev) && dev->dev_status) {
         dev->dev_status--;  /* 标记驱动可以使用 */
     }
 
-    spin_unlock(&dev->lock);
+    gpioled_unlock(dev);
     return 0;
 }
 
+static long gpioled_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct gpioled_dev *dev = filp->private_data;
+    struct gpioled_wait_stats st;
+    u32 ms = 0;
+
+    switch (cmd)
+    {
+    case OPEN_TIMEOUT_CMD:
+        if (copy_from_user(&ms, (void __user *)arg, sizeof(ms))) {
+            return -EFAULT;
+        }
+        gpioled_lock(dev);
+        dev->open_timeout_ms = ms;  /* 对之后进入队列的 open 生效 */
+        gpioled_unlock(dev);
+        return 0;
+    case OPEN_STATS_CMD:
+        gpioled_lock(dev);
+        st = dev->wstats;
+        st.wait_avg_ns = st.handoffs ? div64_u64(dev->wait_sum_ns, st.handoffs) : 0;
+        gpioled_unlock(dev);
+        if (copy_to_user((void __user *)arg, &st, sizeof(st))) {
+            return -EFAULT;
+        }
+        return 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
 /* 字符设备操作集合 */
 static struct file_operations gpioled_fops = { 
     .owner = THIS_MODULE,
     .open = gpioled_open, 
     .read = gpioled_read, 
     .write = gpioled_write, 
+    .unlocked_ioctl = gpioled_ioctl,
     .release = gpioled_release, 
 };
 
+static const struct attribute_group *gpioled_groups[] = {
+    &err_stats_group,
+    NULL,
+};
+
 static int __init led_init(void)
 {
     int ret = 0;
@@ -111,6 +371,7 @@ static int __init led_init(void)
     /* 初始化自旋锁 */
     spin_lock_init(&gpioled.lock);
     gpioled.dev_status = 0;
+    init_waitqueue_head(&gpioled.open_wq);
 
     /* 注册设备号 */
     ret = alloc_chrdev_region(&gpioled.devid, 0, GPIOLED_CNT, GPIOLED_NAME);
@@ -140,7 +401,8 @@ static int __init led_init(void)
     }
 
     /* 创建设备 */
-    gpioled.device = device_create(gpioled.class, NULL, gpioled.devid, NULL, GPIOLED_NAME);
+    gpioled.device = device_create_with_groups(gpioled.class, NULL, gpioled.devid, &gpioled.errors,
+                                               gpioled_groups, GPIOLED_NAME);
     if (IS_ERR(gpioled.device)) {
         ret = PTR_ERR(gpioled.device);
         printk("device_create failed.\n");
@@ -182,6 +444,10 @@ static int __init led_init(void)
     /* 输出低电平，点亮LED灯 */
     gpio_set_value(gpioled.led_gpio, 0);
 
+    /* 锁统计入口，debugfs 不可用时驱动照常工作 */
+    gpioled.debugfs = debugfs_create_dir(GPIOLED_NAME, NULL);
+    pcpu_stats_debugfs(&lock_stat, gpioled.debugfs, "lock_enable", "lock_stats");
+
     return 0;
 
 fail_gpio_direction:
@@ -205,6 +471,8 @@ fail_devid:
 
 static void __exit led_exit(void)
 {
+    debugfs_remove_recursive(gpioled.debugfs);
+    pcpu_stats_set(&lock_stat, false);
     /* 关灯 */
     gpio_set_value(gpioled.led_gpio, 1);
     /* 释放IO */
@@ -0,0 +1,45 @@
+#ifndef _ERR_STATS_H
+#define _ERR_STATS_H
+
+/*
+ * write 失败的计数与 sysfs 的 errors 属性，各驱动共用，每个模块只包含一次。
+ * 出错时只加计数，打印用 dev_dbg_ratelimited，热路径上不调用 printk。
+ *
+ * 设备的 drvdata 必须指向该设备的 struct err_stats：
+ *
+ *     static const struct attribute_group *xxx_groups[] = { &err_stats_group, NULL };
+ *     device_create_with_groups(class, NULL, devid, &xxx.errors, xxx_groups, NAME);
+ */
+
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/device.h>
+#include <linux/sysfs.h>
+
+struct err_stats {
+    atomic_long_t fault;    /* write 中 copy_from_user 失败 */
+    atomic_long_t inval;    /* 写入的长度或值不被驱动接受 */
+    atomic_long_t busy;     /* 当前状态下不能执行的写入，如 PWM 开启时写位图 */
+};
+
+/* /sys/class/<class>/<dev>/errors */
+static ssize_t errors_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct err_stats *errors = dev_get_drvdata(dev);
+
+    return sprintf(buf, "fault %ld\ninval %ld\nbusy %ld\n",
+                   atomic_long_read(&errors->fault), atomic_long_read(&errors->inval),
+                   atomic_long_read(&errors->busy));
+}
+static DEVICE_ATTR_RO(errors);
+
+static struct attribute *err_stats_attrs[] = {
+    &dev_attr_errors.attr,
+    NULL,
+};
+
+static const struct attribute_group err_stats_group = {
+    .attrs = err_stats_attrs,
+};
+
+#endif /* _ERR_STATS_H */
@@ -0,0 +1,182 @@
+#ifndef _FOP_STATS_H
+#define _FOP_STATS_H
+
+/*
+ * 字符设备 fop 统计，各驱动共用，每个模块只包含一次。
+ *
+ * 包装驱动的 file_operations，按 CPU 统计 open/read/write/ioctl 的次数、错误数
+ * 与 log2 ns 延迟直方图，开关与 debugfs 文件见 pcpu_stats.h。关闭时包装层
+ * 只多一次间接调用。/sys/kernel/debug/<name>/ 下为 fop_enable 与 fop_stats。
+ *
+ *     cdev_init(&dev.cdev, fop_stats_init(NAME, &xxx_fops));
+ *     ...
+ *     fop_stats_exit();
+ */
+
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+
+#include "pcpu_stats.h"
+
+enum {
+    FOP_OPEN = 0,
+    FOP_READ,
+    FOP_WRITE,
+    FOP_IOCTL,
+    FOP_NR,
+};
+
+struct fop_stat_cpu {
+    u64 ops[FOP_NR];
+    u64 errors[FOP_NR];
+    u64 hist[FOP_NR][PCPU_HIST_BUCKETS];
+};
+
+static const struct file_operations *fop_stats_real;   /* 驱动自己的操作集合 */
+static struct file_operations fop_stats_fops;
+static struct dentry *fop_stats_dir;
+
+static const char * const fop_stats_names[FOP_NR] = { "open", "read", "write", "ioctl" };
+
+static void fop_stats_merge(void *sum, const void *pcp)
+{
+    struct fop_stat_cpu *s = sum;
+    const struct fop_stat_cpu *p = pcp;
+    int op = 0;
+
+    for (op = 0; op < FOP_NR; op++) {
+        s->ops[op] += p->ops[op];
+        s->errors[op] += p->errors[op];
+        pcpu_hist_merge(s->hist[op], p->hist[op]);
+    }
+}
+
+static void fop_stats_show(struct seq_file *m, const void *sum)
+{
+    const struct fop_stat_cpu *s = sum;
+    int op = 0;
+
+    for (op = 0; op < FOP_NR; op++) {
+        seq_printf(m, "%s ops %llu errors %llu\n",
+                   fop_stats_names[op], s->ops[op], s->errors[op]);
+    }
+    for (op = 0; op < FOP_NR; op++) {
+        pcpu_hist_print(m, fop_stats_names[op], s->hist[op]);
+    }
+}
+
+/* percpu 部分在 fop_stats_init 中分配 */
+static struct pcpu_stats fop_stats = PCPU_STATS_INIT(fop_stats, NULL, sizeof(struct fop_stat_cpu),
+                                                     fop_stats_merge, fop_stats_show);
+
+/* fop 可能睡眠并换 CPU，用全局单调时钟 */
+static inline u64 fop_stats_start(void)
+{
+    if (pcpu_stats_enabled(&fop_stats)) {
+        return ktime_get_ns();
+    }
+    return 0;
+}
+
+static noinline void fop_stats_account(int op, u64 t0, long ret)
+{
+    struct fop_stat_cpu *st = get_cpu_ptr((struct fop_stat_cpu __percpu *)fop_stats.pcpu);
+    u64 ns = ktime_get_ns() - t0;
+
+    st->ops[op]++;
+    if (ret < 0) {
+        st->errors[op]++;
+    }
+    st->hist[op][pcpu_hist_bucket(ns)]++;
+    put_cpu_ptr(fop_stats.pcpu);
+}
+
+/* t0 为 0 说明开始时未开启，不计入 */
+static inline void fop_stats_end(int op, u64 t0, long ret)
+{
+    if (pcpu_stats_enabled(&fop_stats) && t0) {
+        fop_stats_account(op, t0, ret);
+    }
+}
+
+static int fop_stats_open(struct inode *inode, struct file *filp)
+{
+    u64 t0 = fop_stats_start();
+    int ret = fop_stats_real->open ? fop_stats_real->open(inode, filp) : 0;
+
+    fop_stats_end(FOP_OPEN, t0, ret);
+    return ret;
+}
+
+static ssize_t fop_stats_read(struct file *filp, char __user *buf, size_t cnt, loff_t *offt)
+{
+    u64 t0 = fop_stats_start();
+    ssize_t ret = fop_stats_real->read(filp, buf, cnt, offt);
+
+    fop_stats_end(FOP_READ, t0, ret);
+    return ret;
+}
+
+static ssize_t fop_stats_write(struct file *filp, const char __user *buf, size_t cnt, loff_t *offt)
+{
+    u64 t0 = fop_stats_start();
+    ssize_t ret = fop_stats_real->write(filp, buf, cnt, offt);
+
+    fop_stats_end(FOP_WRITE, t0, ret);
+    return ret;
+}
+
+static long fop_stats_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    u64 t0 = fop_stats_start();
+    long ret = fop_stats_real->unlocked_ioctl(filp, cmd, arg);
+
+    fop_stats_end(FOP_IOCTL, t0, ret);
+    return ret;
+}
+
+/*
+ * 返回给 cdev_init/register_chrdev 的操作集合。分配失败时原样返回 fops，
+ * 驱动照常工作，只是没有统计。
+ */
+static const struct file_operations *fop_stats_init(const char *name,
+                                                    const struct file_operations *fops)
+{
+    fop_stats.pcpu = alloc_percpu(struct fop_stat_cpu);
+    if (fop_stats.pcpu == NULL) {
+        return fops;
+    }
+
+    fop_stats_real = fops;
+    fop_stats_fops = *fops;
+    fop_stats_fops.open = fop_stats_open;
+    if (fops->read) {
+        fop_stats_fops.read = fop_stats_read;
+    }
+    if (fops->write) {
+        fop_stats_fops.write = fop_stats_write;
+    }
+    if (fops->unlocked_ioctl) {
+        fop_stats_fops.unlocked_ioctl = fop_stats_ioctl;
+    }
+
+    /* debugfs 不可用时包装照常，只是无法开启 */
+    fop_stats_dir = debugfs_create_dir(name, NULL);
+    pcpu_stats_debugfs(&fop_stats, fop_stats_dir, "fop_enable", "fop_stats");
+
+    return &fop_stats_fops;
+}
+
+/* 在字符设备删除之后调用 */
+static void fop_stats_exit(void)
+{
+    debugfs_remove_recursive(fop_stats_dir);
+    pcpu_stats_set(&fop_stats, false);
+    free_percpu(fop_stats.pcpu);
+}
+
+#endif /* _FOP_STATS_H */
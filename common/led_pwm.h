@@ -0,0 +1,315 @@
+#ifndef _LED_PWM_H
+#define _LED_PWM_H
+
+/*
+ * hrtimer 软件 PWM，2_led 与 6_gpioled 共用，每个模块只包含一次。
+ *
+ * 驱动提供 output 回调输出一个电平，在 hrtimer 回调中调用，不能睡眠。
+ * pwm_config 会等待定时器回调结束，只能在进程上下文调用，并由调用者串行化；
+ * pwm_fade 只持自旋锁，可以在原子上下文调用。
+ *
+ *     pwm_init(&pwm, xxx_pwm_output);
+ *     pwm_config(&pwm, &cfg);
+ *     pwm_fade(&pwm, &fade);
+ *     ...
+ *     pwm_stop(&pwm);
+ */
+
+#include <linux/kernel.h>
+#include <linux/ioctl.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+
+/* 软件 PWM 亮度与渐变，一次 ioctl 交给内核完成整段渐变 */
+#define LED_PWM_CMD         _IOW(0xEF, 4, struct led_pwm_cfg)    // 配置软件 PWM
+#define LED_FADE_CMD        _IOW(0xEF, 5, struct led_fade)       // 设置亮度或启动渐变
+#define LED_PWM_STATS_CMD   _IOR(0xEF, 6, struct led_pwm_stats)  // 读取 PWM 边沿延迟统计
+
+#define FADE_LINEAR     0
+#define FADE_EASE       1   /* 两端慢中间快 (smoothstep) */
+
+#define PWM_MAX_HZ      20000
+#define PWM_FADE_MAX_MS 600000
+
+struct led_pwm_cfg {
+    __u32 freq_hz;      /* 0 关闭 PWM，恢复开关控制 */
+    __u32 bits;         /* 占空比分辨率，8 或 10 */
+};
+
+struct led_fade {
+    __u32 brightness;   /* 目标亮度 0..255，经过 gamma 校正 */
+    __u32 duration_ms;  /* 0 表示立即生效 */
+    __u32 curve;
+};
+
+struct led_pwm_stats {
+    __u64 periods;
+    __u64 edges;
+    __u64 late_avg_ns;  /* 边沿相对预定时间的平均延迟，即周期抖动 */
+    __u64 late_max_ns;
+};
+
+/* 软件 PWM 状态，lock 保护除 timer 外的全部字段 */
+struct led_pwm {
+    struct hrtimer timer;
+    spinlock_t lock;
+    void (*output)(struct led_pwm *pwm, bool on);
+    bool enabled;
+    bool running;       /* 静态电平时定时器停止，不占 CPU */
+    bool high;          /* 当前处于点亮段 */
+    u32 bits;
+    u64 period_ns;
+    u64 on_ns;
+    u32 duty;
+    u8 cur;             /* 当前亮度 */
+    u8 from;
+    u8 to;
+    u32 curve;
+    bool fading;
+    ktime_t fade_start;
+    u64 fade_ns;
+    u64 periods;
+    u64 edges;
+    u64 late_sum_ns;
+    u64 late_max_ns;
+};
+
+/* gamma 2.2 校正表，8 位亮度到 10 位占空比，round(1023 * (i / 255)^2.2) */
+static const u16 pwm_gamma[256] = {
+        0,    0,    0,    0,    0,    0,    0,    0,    1,    1,    1,    1,    1,    1,    2,    2,
+       2,    3,    3,    3,    4,    4,    5,    5,    6,    6,    7,    7,    8,    9,    9,   10,
+      11,   11,   12,   13,   14,   15,   16,   16,   17,   18,   19,   20,   21,   23,   24,   25,
+      26,   27,   28,   30,   31,   32,   34,   35,   36,   38,   39,   41,   42,   44,   46,   47,
+      49,   51,   52,   54,   56,   58,   60,   61,   63,   65,   67,   69,   71,   73,   76,   78,
+      80,   82,   84,   87,   89,   91,   94,   96,   98,  101,  103,  106,  109,  111,  114,  117,
+     119,  122,  125,  128,  130,  133,  136,  139,  142,  145,  148,  151,  155,  158,  161,  164,
+     167,  171,  174,  177,  181,  184,  188,  191,  195,  198,  202,  206,  209,  213,  217,  221,
+     225,  228,  232,  236,  240,  244,  248,  252,  257,  261,  265,  269,  274,  278,  282,  287,
+     291,  295,  300,  304,  309,  314,  318,  323,  328,  333,  337,  342,  347,  352,  357,  362,
+     367,  372,  377,  382,  387,  393,  398,  403,  408,  414,  419,  425,  430,  436,  441,  447,
+     452,  458,  464,  470,  475,  481,  487,  493,  499,  505,  511,  517,  523,  529,  535,  542,
+     548,  554,  561,  567,  573,  580,  586,  593,  599,  606,  613,  619,  626,  633,  640,  647,
+     653,  660,  667,  674,  681,  689,  696,  703,  710,  717,  725,  732,  739,  747,  754,  762,
+     769,  777,  784,  792,  800,  807,  815,  823,  831,  839,  847,  855,  863,  871,  879,  887,
+     895,  903,  912,  920,  928,  937,  945,  954,  962,  971,  979,  988,  997, 1005, 1014, 1023,
+};
+
+static inline u32 pwm_full(struct led_pwm *pwm)
+{
+    return (1 << pwm->bits) - 1;
+}
+
+static inline u32 pwm_duty(struct led_pwm *pwm, u8 brightness)
+{
+    return pwm_gamma[brightness] >> (10 - pwm->bits);
+}
+
+/* 推进渐变，每个周期开始时调用一次，调用者持有 pwm->lock */
+static void pwm_fade_step(struct led_pwm *pwm, ktime_t now)
+{
+    u64 elapsed = 0;
+    u32 p = 0;
+    u32 p2 = 0;
+    u32 p3 = 0;
+
+    if (!pwm->fading) {
+        return;
+    }
+
+    elapsed = ktime_to_ns(ktime_sub(now, pwm->fade_start));
+    if (elapsed >= pwm->fade_ns) {
+        pwm->cur = pwm->to;
+        pwm->fading = false;
+    } else {
+        p = div64_u64(elapsed << 16, pwm->fade_ns);    /* 进度，16 位定点 */
+        if (pwm->curve == FADE_EASE) {
+            p2 = (p * p) >> 16;
+            p3 = (p2 * p) >> 16;
+            p = 3 * p2 - 2 * p3;
+        }
+        pwm->cur = pwm->from + ((((s32)pwm->to - pwm->from) * (s32)p) >> 16);
+    }
+    pwm->duty = pwm_duty(pwm, pwm->cur);
+}
+
+static enum hrtimer_restart pwm_timer_func(struct hrtimer *timer)
+{
+    struct led_pwm *pwm = container_of(timer, struct led_pwm, timer);
+    ktime_t now = hrtimer_cb_get_time(timer);
+    u64 late = ktime_to_ns(ktime_sub(now, hrtimer_get_expires(timer)));
+    u32 full = 0;
+
+    spin_lock(&pwm->lock);
+    pwm->edges++;
+    pwm->late_sum_ns += late;
+    pwm->late_max_ns = max(pwm->late_max_ns, late);
+    if (!pwm->enabled) {
+        pwm->running = false;
+        spin_unlock(&pwm->lock);
+        return HRTIMER_NORESTART;
+    }
+    /* 落后超过一个周期时从当前时刻重新开始，不补发错过的边沿 */
+    if (late > pwm->period_ns) {
+        hrtimer_set_expires(timer, now);
+    }
+
+    if (pwm->high) {
+        /* 点亮段结束 */
+        pwm->output(pwm, false);
+        pwm->high = false;
+        hrtimer_add_expires_ns(timer, pwm->period_ns - pwm->on_ns);
+        spin_unlock(&pwm->lock);
+        return HRTIMER_RESTART;
+    }
+
+    /* 周期开始 */
+    pwm->periods++;
+    pwm_fade_step(pwm, now);
+    full = pwm_full(pwm);
+    pwm->on_ns = div_u64(pwm->period_ns * pwm->duty, full);
+    pwm->output(pwm, pwm->duty != 0);
+    if (pwm->duty == 0 || pwm->duty == full) {
+        if (!pwm->fading) {
+            pwm->running = false;
+            spin_unlock(&pwm->lock);
+            return HRTIMER_NORESTART;
+        }
+        hrtimer_add_expires_ns(timer, pwm->period_ns);
+    } else {
+        pwm->high = true;
+        hrtimer_add_expires_ns(timer, pwm->on_ns);
+    }
+    spin_unlock(&pwm->lock);
+
+    return HRTIMER_RESTART;
+}
+
+/* 需要定时器时启动，静态电平直接输出，调用者持有 pwm->lock */
+static void pwm_kick(struct led_pwm *pwm)
+{
+    if (pwm->running) {
+        return;     /* 下个周期开始时生效 */
+    }
+    if (!pwm->fading && (pwm->duty == 0 || pwm->duty == pwm_full(pwm))) {
+        pwm->output(pwm, pwm->duty != 0);
+        return;
+    }
+    pwm->running = true;
+    pwm->high = false;
+    hrtimer_start(&pwm->timer, ktime_get(), HRTIMER_MODE_ABS);
+}
+
+static int pwm_config(struct led_pwm *pwm, struct led_pwm_cfg *cfg)
+{
+    unsigned long flags;
+
+    if (cfg->freq_hz > PWM_MAX_HZ) {
+        return -EINVAL;
+    }
+    if (cfg->freq_hz && cfg->bits != 8 && cfg->bits != 10) {
+        return -EINVAL;
+    }
+    /*
+     * 未开启时关闭什么也不做：不输出电平，不改写用户最后一次写入的状态，
+     * 驱动也未为 PWM 打开时钟。enabled 只在这里和 pwm_stop 中修改，调用者已串行化
+     */
+    if (!cfg->freq_hz && !pwm->enabled) {
+        return 0;
+    }
+
+    /* 先关闭再取消定时器，回调看到 enabled 为假后不会再重启 */
+    spin_lock_irqsave(&pwm->lock, flags);
+    pwm->enabled = false;
+    pwm->fading = false;
+    spin_unlock_irqrestore(&pwm->lock, flags);
+    hrtimer_cancel(&pwm->timer);
+
+    spin_lock_irqsave(&pwm->lock, flags);
+    pwm->running = false;
+    if (cfg->freq_hz) {
+        pwm->enabled = true;
+        pwm->bits = cfg->bits;
+        pwm->period_ns = div_u64(NSEC_PER_SEC, cfg->freq_hz);
+        pwm->duty = pwm_duty(pwm, pwm->cur);
+        pwm_kick(pwm);
+    } else {
+        pwm->output(pwm, pwm->cur != 0);
+    }
+    spin_unlock_irqrestore(&pwm->lock, flags);
+
+    return 0;
+}
+
+static int pwm_fade(struct led_pwm *pwm, struct led_fade *fade)
+{
+    unsigned long flags;
+
+    if (fade->brightness > 255 || fade->duration_ms > PWM_FADE_MAX_MS || fade->curve > FADE_EASE) {
+        return -EINVAL;
+    }
+
+    spin_lock_irqsave(&pwm->lock, flags);
+    if (!pwm->enabled) {
+        spin_unlock_irqrestore(&pwm->lock, flags);
+        return -EINVAL;
+    }
+    pwm->from = pwm->cur;
+    pwm->to = fade->brightness;
+    pwm->curve = fade->curve;
+    pwm->fade_start = ktime_get();
+    pwm->fade_ns = (u64)fade->duration_ms * NSEC_PER_MSEC;
+    if (pwm->fade_ns == 0) {
+        pwm->cur = pwm->to;
+        pwm->fading = false;
+        pwm->duty = pwm_duty(pwm, pwm->cur);
+    } else {
+        pwm->fading = true;
+    }
+    pwm_kick(pwm);
+    spin_unlock_irqrestore(&pwm->lock, flags);
+
+    return 0;
+}
+
+/* 开关式写入在 PWM 开启时转成立即生效的亮度 */
+static int pwm_switch(struct led_pwm *pwm, bool on)
+{
+    struct led_fade fade = { on ? 255 : 0, 0, FADE_LINEAR };
+
+    return pwm_fade(pwm, &fade);
+}
+
+static void pwm_get_stats(struct led_pwm *pwm, struct led_pwm_stats *st)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&pwm->lock, flags);
+    st->periods = pwm->periods;
+    st->edges = pwm->edges;
+    st->late_avg_ns = pwm->edges ? div64_u64(pwm->late_sum_ns, pwm->edges) : 0;
+    st->late_max_ns = pwm->late_max_ns;
+    spin_unlock_irqrestore(&pwm->lock, flags);
+}
+
+static void pwm_init(struct led_pwm *pwm, void (*output)(struct led_pwm *pwm, bool on))
+{
+    spin_lock_init(&pwm->lock);
+    hrtimer_init(&pwm->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    pwm->timer.function = pwm_timer_func;
+    pwm->output = output;
+    pwm->bits = 8;
+}
+
+static void pwm_stop(struct led_pwm *pwm)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&pwm->lock, flags);
+    pwm->enabled = false;
+    spin_unlock_irqrestore(&pwm->lock, flags);
+    hrtimer_cancel(&pwm->timer);
+}
+
+#endif /* _LED_PWM_H */
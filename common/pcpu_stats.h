@@ -0,0 +1,164 @@
+#ifndef _PCPU_STATS_H
+#define _PCPU_STATS_H
+
+/*
+ * static key 开关的每 CPU 统计与 log2 ns 直方图，fop_stats.h 与各驱动的锁统计共用，
+ * 每个模块只包含一次。
+ *
+ * 统计结构由使用者定义，热路径在 pcpu_stats_enabled() 为真时只改本 CPU 那一份，
+ * 不用原子操作也不加锁，关闭时只有一条跳转指令。debugfs 下两个文件：
+ * 开关写 1 开启；统计读出时按 merge 合并各 CPU 再交给 show 打印，写入任意内容清零。
+ *
+ *     static struct pcpu_stats xxx_stats = PCPU_STATS_INIT(xxx_stats, &xxx_pcpu,
+ *                                          sizeof(struct xxx_stat), xxx_merge, xxx_show);
+ *     ...
+ *     pcpu_stats_debugfs(&xxx_stats, dir, "xxx_enable", "xxx_stats");
+ *     ...
+ *     pcpu_stats_set(&xxx_stats, false);      // 卸载前关闭
+ */
+
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/percpu.h>
+#include <linux/jump_label.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+
+#define PCPU_HIST_BUCKETS 32    /* log2 ns，最后一格包含更长的时间 */
+
+struct pcpu_stats {
+    struct static_key key;
+    void __percpu *pcpu;            /* 每 CPU 一份 size 字节的统计 */
+    size_t size;
+    struct mutex mutex;             /* 串行化开关 */
+    bool on;
+    void (*merge)(void *sum, const void *pcp);          /* 把一个 CPU 的统计加到 sum */
+    void (*show)(struct seq_file *m, const void *sum);
+};
+
+#define PCPU_STATS_INIT(name, _pcpu, _size, _merge, _show) {   \
+    .key = STATIC_KEY_INIT_FALSE,                               \
+    .pcpu = (void __percpu *)(_pcpu),                           \
+    .size = (_size),                                            \
+    .mutex = __MUTEX_INITIALIZER(name.mutex),                   \
+    .merge = (_merge),                                          \
+    .show = (_show),                                            \
+}
+
+/* 宏而不是函数，static key 的地址需要是编译期常量 */
+#define pcpu_stats_enabled(st) static_key_false(&(st)->key)
+
+static inline unsigned int pcpu_hist_bucket(u64 ns)
+{
+    return min_t(unsigned int, ns ? fls64(ns) - 1 : 0, PCPU_HIST_BUCKETS - 1);
+}
+
+static inline void pcpu_hist_merge(u64 *sum, const u64 *hist)
+{
+    int i = 0;
+
+    for (i = 0; i < PCPU_HIST_BUCKETS; i++) {
+        sum[i] += hist[i];
+    }
+}
+
+/* 每行为 < 该值的次数，空的格子不打印 */
+static void pcpu_hist_print(struct seq_file *m, const char *name, const u64 *hist)
+{
+    int i = 0;
+
+    for (i = 0; i < PCPU_HIST_BUCKETS; i++) {
+        if (hist[i]) {
+            seq_printf(m, "%s %10llu ns %llu\n", name, 1ULL << (i + 1), hist[i]);
+        }
+    }
+}
+
+static int pcpu_stats_seq_show(struct seq_file *m, void *v)
+{
+    struct pcpu_stats *st = m->private;
+    void *sum = NULL;
+    int cpu = 0;
+
+    sum = kzalloc(st->size, GFP_KERNEL);
+    if (sum == NULL) {
+        return -ENOMEM;
+    }
+    for_each_possible_cpu(cpu) {
+        st->merge(sum, per_cpu_ptr(st->pcpu, cpu));
+    }
+
+    seq_printf(m, "enabled %d\n", st->on);
+    st->show(m, sum);
+    kfree(sum);
+
+    return 0;
+}
+
+static int pcpu_stats_seq_open(struct inode *inode, struct file *filp)
+{
+    return single_open(filp, pcpu_stats_seq_show, inode->i_private);
+}
+
+/* 写入清零，与正在进行的统计并发时可能丢几次计数 */
+static ssize_t pcpu_stats_reset(struct file *filp, const char __user *buf,
+                                size_t cnt, loff_t *offt)
+{
+    struct pcpu_stats *st = ((struct seq_file *)filp->private_data)->private;
+    int cpu = 0;
+
+    for_each_possible_cpu(cpu) {
+        memset(per_cpu_ptr(st->pcpu, cpu), 0, st->size);
+    }
+    return cnt;
+}
+
+static const struct file_operations pcpu_stats_seq_fops = {
+    .owner = THIS_MODULE,
+    .open = pcpu_stats_seq_open,
+    .read = seq_read,
+    .write = pcpu_stats_reset,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static void pcpu_stats_set(struct pcpu_stats *st, bool on)
+{
+    mutex_lock(&st->mutex);
+    if (on && !st->on) {
+        static_key_slow_inc(&st->key);
+    } else if (!on && st->on) {
+        static_key_slow_dec(&st->key);
+    }
+    st->on = on;
+    mutex_unlock(&st->mutex);
+}
+
+static int pcpu_stats_enable_get(void *data, u64 *val)
+{
+    *val = ((struct pcpu_stats *)data)->on;
+    return 0;
+}
+
+static int pcpu_stats_enable_set(void *data, u64 val)
+{
+    pcpu_stats_set(data, val != 0);
+    return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(pcpu_stats_enable_fops, pcpu_stats_enable_get,
+                        pcpu_stats_enable_set, "%llu\n");
+
+/* dir 不可用时什么也不做，统计保持关闭 */
+static void pcpu_stats_debugfs(struct pcpu_stats *st, struct dentry *dir,
+                               const char *enable_name, const char *stats_name)
+{
+    if (IS_ERR_OR_NULL(dir)) {
+        return;
+    }
+    debugfs_create_file(enable_name, 0600, dir, st, &pcpu_stats_enable_fops);
+    debugfs_create_file(stats_name, 0600, dir, st, &pcpu_stats_seq_fops);
+}
+
+#endif /* _PCPU_STATS_H */
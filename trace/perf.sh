@@ -0,0 +1,31 @@
+#!/bin/sh
+# 没有 bpftrace 时用 perf 看同一组跟踪点
+# ./perf.sh stat [秒]      每秒输出各跟踪点的次数
+# ./perf.sh record [秒]    记录事件，结束后 perf script 打印，可按 enter/exit 时间戳算延迟
+
+EVENTS=""
+for sys in drv_gpioled drv_beep drv_key drv_timer; do
+    if [ -d /sys/kernel/debug/tracing/events/$sys ]; then
+        EVENTS="$EVENTS -e $sys:*"
+    fi
+done
+
+if [ -z "$EVENTS" ]; then
+    echo "no driver tracepoints, load the modules and mount debugfs first."
+    exit 1
+fi
+
+SECS=${2:-10}
+
+case "$1" in
+stat)
+    perf stat -a -I 1000 $EVENTS -- sleep $SECS
+    ;;
+record)
+    perf record -a -o drv.data $EVENTS -- sleep $SECS && perf script -i drv.data
+    ;;
+*)
+    echo "usage: $0 stat|record [seconds]"
+    exit 1
+    ;;
+esac